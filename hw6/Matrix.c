@@ -1,10 +1,25 @@
 // File: Matrix.c
 // Implementation of the Matrix ADT
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "Matrix.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Rows handed to one fill thread at a time; below this we fill inline
+#define FILL_ROW_BLOCK 64
+#define FILL_MAX_THREADS 64
+
+// The fill functions are not declared in Matrix.h; declared here so
+// they have prototypes
+void mat_fill_uniform(Matrix mat, uint64_t seed, float lo, float hi);
+void mat_fill_normal(Matrix mat, uint64_t seed, float mean, float stddev);
 
 struct matrix_st {
     size_t rows;
@@ -46,6 +61,144 @@ static bool valid_row(const Matrix mat, size_t row) {
     return row >= 1 && row <= mat->rows;
 }
 
+// Philox4x32-10 counter-based generator (Salmon et al., SC'11).
+// Output depends only on (key, counter), so any element can be generated
+// independently of every other one, in any order, on any thread.
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// Counters generated together.  x[w][l] holds word w of counter l, so
+// each round is one loop over independent lanes: the multiplies of
+// different counters overlap in the pipeline (and vectorize where the
+// compiler can), instead of waiting on one counter's dependency chain.
+#define PHILOX_LANES 8
+
+static void philox4x32_lanes(uint32_t x[4][PHILOX_LANES], uint64_t seed) {
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+
+    for (int round = 0; round < 10; ++round) {
+        for (int l = 0; l < PHILOX_LANES; ++l) {
+            uint64_t p0 = (uint64_t)PHILOX_M0 * x[0][l];
+            uint64_t p1 = (uint64_t)PHILOX_M1 * x[2][l];
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ x[1][l] ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ x[3][l] ^ k1;
+            x[1][l] = (uint32_t)p1;
+            x[3][l] = (uint32_t)p0;
+            x[0][l] = n0;
+            x[2][l] = n2;
+        }
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+// Maps 32 random bits to a float in the open interval (0, 1).  Only 23
+// bits are used so that k + 0.5 is exact in a float; with 24 bits the
+// top value rounds up to 2^24 and the result would be exactly 1.
+static float u32_to_unit(uint32_t x) {
+    return ((float)(x >> 9) + 0.5f) * (1.0f / 8388608.0f);
+}
+
+typedef enum { FILL_UNIFORM, FILL_NORMAL } FillKind;
+
+typedef struct {
+    Matrix mat;
+    FillKind kind;
+    uint64_t seed;
+    float a;   // lo (uniform) or mean (normal)
+    float b;   // hi (uniform) or stddev (normal)
+    size_t next_block;  // shared row-block cursor
+    pthread_mutex_t lock;
+} fill_job;
+
+// Fills one row; element (row, col) always comes from word col % 4 of
+// counter {row, col / 4} (each split in 32-bit halves), independent of
+// thread layout.  PHILOX_LANES counters are generated per step.
+static void fill_row(const fill_job *job, size_t row) {
+    float *dst = job->mat->data[row];
+    size_t cols = job->mat->cols;
+    uint32_t x[4][PHILOX_LANES];
+    float v[4 * PHILOX_LANES];
+
+    for (size_t j = 0; j < cols; j += 4 * PHILOX_LANES) {
+        for (int l = 0; l < PHILOX_LANES; ++l) {
+            uint64_t block = j / 4 + (size_t)l;
+            x[0][l] = (uint32_t)row;
+            x[1][l] = (uint32_t)block;
+            x[2][l] = (uint32_t)((uint64_t)row >> 32);
+            x[3][l] = (uint32_t)(block >> 32);
+        }
+        philox4x32_lanes(x, job->seed);
+
+        if (job->kind == FILL_UNIFORM) {
+            float scale = job->b - job->a;
+            for (int k = 0; k < 4; ++k) {
+                for (int l = 0; l < PHILOX_LANES; ++l) {
+                    v[4 * l + k] = job->a + scale * u32_to_unit(x[k][l]);
+                }
+            }
+        } else {
+            // Box-Muller: two uniforms -> two independent normals
+            for (int l = 0; l < PHILOX_LANES; ++l) {
+                for (int k = 0; k < 4; k += 2) {
+                    float rad = sqrtf(-2.0f * logf(u32_to_unit(x[k][l])));
+                    float theta = 6.28318530718f * u32_to_unit(x[k + 1][l]);
+                    v[4 * l + k] = job->a + job->b * rad * cosf(theta);
+                    v[4 * l + k + 1] = job->a + job->b * rad * sinf(theta);
+                }
+            }
+        }
+
+        size_t n = cols - j < 4 * PHILOX_LANES ? cols - j : 4 * PHILOX_LANES;
+        memcpy(dst + j, v, n * sizeof(float));
+    }
+}
+
+static void *fill_worker(void *arg) {
+    fill_job *job = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t start = job->next_block;
+        job->next_block += FILL_ROW_BLOCK;
+        pthread_mutex_unlock(&job->lock);
+
+        if (start >= job->mat->rows) break;
+        size_t end = start + FILL_ROW_BLOCK;
+        if (end > job->mat->rows) end = job->mat->rows;
+        for (size_t i = start; i < end; ++i) {
+            fill_row(job, i);
+        }
+    }
+    return NULL;
+}
+
+static void fill_parallel(fill_job *job) {
+    size_t blocks = (job->mat->rows + FILL_ROW_BLOCK - 1) / FILL_ROW_BLOCK;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = ncpu > 0 ? (size_t)ncpu : 1;
+    if (nthreads > blocks) nthreads = blocks;
+    if (nthreads > FILL_MAX_THREADS) nthreads = FILL_MAX_THREADS;
+
+    job->next_block = 0;
+    pthread_mutex_init(&job->lock, NULL);
+
+    pthread_t tids[FILL_MAX_THREADS];
+    size_t started = 0;
+    for (size_t t = 1; t < nthreads; ++t) {
+        if (pthread_create(&tids[started], NULL, fill_worker, job) != 0) break;
+        ++started;
+    }
+    fill_worker(job);   // calling thread takes blocks too
+    for (size_t t = 0; t < started; ++t) {
+        pthread_join(tids[t], NULL);
+    }
+
+    pthread_mutex_destroy(&job->lock);
+}
+
 Matrix mat_create(size_t rows, size_t cols) {
     if (rows == 0 || cols == 0) return NULL;
 
@@ -129,6 +282,22 @@ void mat_scalar_mult(Matrix mat, float data) {
     }
 }
 
+void mat_fill_uniform(Matrix mat, uint64_t seed, float lo, float hi) {
+    if (!mat) return;
+
+    fill_job job = { .mat = mat, .kind = FILL_UNIFORM, .seed = seed,
+                     .a = lo, .b = hi };
+    fill_parallel(&job);
+}
+
+void mat_fill_normal(Matrix mat, uint64_t seed, float mean, float stddev) {
+    if (!mat) return;
+
+    fill_job job = { .mat = mat, .kind = FILL_NORMAL, .seed = seed,
+                     .a = mean, .b = stddev };
+    fill_parallel(&job);
+}
+
 Matrix mat_mult(const Matrix m1, const Matrix m2) {
     if (!m1 || !m2 || m1->cols != m2->rows) return NULL;
 
@@ -8,41 +8,378 @@
  *
  * This program implements Quicksort in two versions:
  *   1. Classic recursive (single-threaded)
- *   2. Multi-threaded using POSIX threads
+ *   2. Multi-threaded on a fixed pool of POSIX threads
  *
  * Both versions allocate and return a new sorted array.
- * The program reads integers from a file and reports CPU time
- * and number of threads spawned in the threaded version.
+ * The program reads integers from a file and reports wall-clock time,
+ * plus pool size, tasks executed and steals for the threaded version.
+ * With -b it instead benchmarks every algorithm on generated inputs
+ * and prints CSV, including the type-generic sorts of sort_generic.h
+ * against qsort.
+ *
+ * The non-threaded version copies the input once and then sorts that
+ * copy in place with a three-way partition; the original
+ * allocate-per-level version is kept as legacy_quicksort for
+ * comparison (-l).  The partition kernel is a branch-free block
+ * partition (BlockQuicksort), an AVX-512/AVX2 vector partition when
+ * the CPU supports it (the default, -K simd), or the Dutch national
+ * flag loop with -K dutch.
+ *
+ * Partitions that recurse past 2*log2(n) levels are finished with
+ * heapsort (introsort), so the worst case is O(n log n); badly
+ * unbalanced partitions also shuffle a few elements (as in pdqsort).
+ * Input made mostly of long ascending or descending runs is instead
+ * sorted by merging its runs (powersort); -R turns that check off.
+ *
+ * For 32-bit keys an LSD radix sort (-a radix) is also available, as
+ * is a stable parallel merge sort (-a merge); -a auto picks radix sort
+ * or quicksort from the input size and range.
+ *
+ * Input and sorted output can also be raw little-endian int32/int64
+ * (-f, -w, -W), so binary producers skip text conversion entirely.
+ * -q and -k report percentiles or the largest values by quickselect
+ * instead of sorting (-w writes either list), and -i reports the
+ * sorting permutation (argsort, via the key/payload sorts).  -u
+ * reports the distinct values, each value's count, or just how many
+ * there are, dropping duplicates as the three-way partitions find them.
+ * A file name of - sorts standard input while it is still arriving
+ * (a plain sort only: -q, -k, -u, -i, -U, -a, -l and -m are refused).
+ * -U base merges the sorted input into a sorted binary base file
+ * (with -L, only every few batches, LSM style).
+ * With -M budget the input is sorted externally in runs that fit the
+ * budget and merged from temporary files, so it need not fit in memory
+ * (a plain sort of a named file, refusing the same flags as -).
+ *
+ * Built with -DSORT_STATS, -S text|json also reports comparisons,
+ * moves, recursion depth and partition balance histograms, bytes
+ * allocated and time spent partitioning, merging and leaf sorting,
+ * for whichever mode runs (sort, selection, distinct, argsort,
+ * update, external or streaming).
+ *
+ * Built with -DSORT_SELFTEST (make check) and run without arguments,
+ * the program instead checks every sorting network on all 0-1 inputs,
+ * every engine, kernel and pivot against qsort on the benchmark
+ * distributions, and the argsort, distinct, selection, external,
+ * update and streaming paths.
+ *
+ * Pivots are chosen by median-of-three or Tukey's ninther depending on
+ * partition size, or by a hashed random index (-P random); -P first
+ * restores the original data[0] pivot.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE             // syscall() for perf_event_open
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/// Structure passed to each thread in the threaded quicksort
-typedef struct {
-    size_t   size;     ///< number of elements to sort
-    const int *data;   ///< pointer to original unsorted data
-    int      *result;  ///< where to store sorted result (output)
-    int       threads_spawned; ///< total threads created in subtree
-} thread_args_t;
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+
+#include "sort_generic.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Sort statistics (compiled in with -DSORT_STATS, reported with -S)
+ *
+ * Every thread counts into its own sort_stats_t, so the hooks need no
+ * locking; stats_collect adds the per-thread records up once the sort
+ * has finished.  Without SORT_STATS the STAT_* hooks expand to nothing.
+ */
+
+#ifdef SORT_STATS
+
+/// Recursion depth histogram buckets (deeper levels share the last)
+#define STATS_DEPTHS 48
+
+/// Partition balance histogram buckets: the smaller side's share of
+/// the elements that are not copies of the pivot, in steps of 0.05
+#define STATS_BALANCE 10
+
+/// Counters of one thread, or their sum over all threads.  Vector
+/// kernels count one comparison and one move per element per pass;
+/// radix and samplesort distribution passes count as partition time.
+typedef struct sort_stats {
+    unsigned long long comparisons;
+    unsigned long long moves;               ///< element writes
+    unsigned long long partitions;
+    unsigned long long depth[STATS_DEPTHS]; ///< partitions per level
+    unsigned long long balance[STATS_BALANCE];
+    unsigned long long bytes;               ///< bytes allocated
+    double             partition_time;     ///< seconds, summed over threads
+    double             merge_time;
+    double             leaf_time;          ///< small sorts and heapsort
+    unsigned           level;              ///< depth of the next introsort
+    struct sort_stats *next;
+} sort_stats_t;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static sort_stats_t *stats_threads;         ///< every thread's record
+static unsigned stats_generation = 1;       ///< bumped by stats_collect
+static __thread sort_stats_t *stats_mine;
+static __thread unsigned stats_mine_generation;
+
+/// Returns the calling thread's record, registering a new one on the
+/// first call since the last stats_collect
+static sort_stats_t *stats_local( void )
+{
+    if ( stats_mine != NULL && stats_mine_generation == stats_generation )
+        return stats_mine;
+
+    sort_stats_t *s = calloc( 1, sizeof( sort_stats_t ) );
+    if ( s == NULL ) {
+        perror( "malloc failed in stats_local" );
+        exit( EXIT_FAILURE );
+    }
+    pthread_mutex_lock( &stats_lock );
+    s->next = stats_threads;
+    stats_threads = s;
+    stats_mine_generation = stats_generation;
+    pthread_mutex_unlock( &stats_lock );
+    stats_mine = s;
+    return s;
+}
+
+/// Monotonic time in seconds
+static double stats_now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+/// Records one partition of size elements into lt below and size - gt
+/// above the pivot, level partitions below the root
+static void stats_partition( unsigned level, size_t size, size_t lt,
+                             size_t gt )
+{
+    sort_stats_t *s = stats_local();
+    size_t more = size - gt;
 
-/// Global counter for total threads created (updated atomically)
-static volatile int total_threads = 0;
+    s->partitions++;
+    s->depth[ level < STATS_DEPTHS ? level : STATS_DEPTHS - 1 ]++;
+    if ( lt + more > 0 ) {
+        size_t smaller = lt < more ? lt : more;
+        size_t b = smaller * 2 * STATS_BALANCE / ( lt + more );
+        s->balance[ b < STATS_BALANCE ? b : STATS_BALANCE - 1 ]++;
+    }
+}
+
+/// Adds every thread's record into total and starts over.  Only call
+/// once the threads that did the counting are finished.
+static void stats_collect( sort_stats_t *total )
+{
+    memset( total, 0, sizeof( *total ) );
 
-/// Increments the global thread counter in a thread-safe way
-static void increment_thread_counter( void )
+    pthread_mutex_lock( &stats_lock );
+    while ( stats_threads != NULL ) {
+        sort_stats_t *s = stats_threads;
+        total->comparisons    += s->comparisons;
+        total->moves          += s->moves;
+        total->partitions     += s->partitions;
+        total->bytes          += s->bytes;
+        total->partition_time += s->partition_time;
+        total->merge_time     += s->merge_time;
+        total->leaf_time      += s->leaf_time;
+        for ( size_t i = 0; i < STATS_DEPTHS; i++ )
+            total->depth[i] += s->depth[i];
+        for ( size_t i = 0; i < STATS_BALANCE; i++ )
+            total->balance[i] += s->balance[i];
+        stats_threads = s->next;
+        free( s );
+    }
+    stats_generation++;
+    pthread_mutex_unlock( &stats_lock );
+}
+
+/// Prints the statistics gathered since the last report for the sort
+/// named label, as aligned text or as one JSON object per line
+static void stats_report( const char *label, int json )
 {
-    __sync_fetch_and_add( &total_threads, 1 );
+    sort_stats_t t;
+    size_t depths = STATS_DEPTHS;
+
+    stats_collect( &t );
+    while ( depths > 0 && t.depth[depths - 1] == 0 )
+        depths--;
+
+    if ( json ) {
+        printf( "{\"sort\":\"%s\",\"comparisons\":%llu,\"moves\":%llu,"
+                "\"partitions\":%llu,\"bytes_allocated\":%llu,"
+                "\"partition_time\":%f,\"merge_time\":%f,"
+                "\"leaf_time\":%f,\"depth\":[", label, t.comparisons,
+                t.moves, t.partitions, t.bytes, t.partition_time,
+                t.merge_time, t.leaf_time );
+        for ( size_t i = 0; i < depths; i++ )
+            printf( "%s%llu", i > 0 ? "," : "", t.depth[i] );
+        printf( "],\"balance\":[" );
+        for ( size_t i = 0; i < STATS_BALANCE; i++ )
+            printf( "%s%llu", i > 0 ? "," : "", t.balance[i] );
+        printf( "]}\n" );
+        return;
+    }
+
+    printf( "Statistics (%s):\n", label );
+    printf( "  Comparisons:      %llu\n", t.comparisons );
+    printf( "  Moves:            %llu\n", t.moves );
+    printf( "  Partitions:       %llu\n", t.partitions );
+    printf( "  Bytes allocated:  %llu\n", t.bytes );
+    printf( "  Partition time:   %f\n", t.partition_time );
+    printf( "  Merge time:       %f\n", t.merge_time );
+    printf( "  Leaf sort time:   %f\n", t.leaf_time );
+    printf( "  Depth:           " );
+    for ( size_t i = 0; i < depths; i++ )
+        printf( " %zu:%llu", i, t.depth[i] );
+    printf( "\n  Balance:         " );
+    for ( size_t i = 0; i < STATS_BALANCE; i++ )
+        printf( " <%.2f:%llu", (double) ( i + 1 ) / ( 2 * STATS_BALANCE ),
+                t.balance[i] );
+    printf( "\n" );
 }
 
+#define STAT_ADD( field, n )            ( stats_local()->field += (n) )
+#define STAT_ALLOC( n )                 STAT_ADD( bytes, (n) )
+#define STAT_TIMER( t )                 double t = stats_now()
+#define STAT_ELAPSED( t, field )        STAT_ADD( field, stats_now() - (t) )
+#define STAT_LEVEL( l )                 unsigned l = stats_local()->level
+#define STAT_SET_LEVEL( l )             ( stats_local()->level = (l) )
+#define STAT_PARTITION( l, size, lt, gt ) \
+    stats_partition( (l), (size), (lt), (gt) )
+#define STAT_RESET()                    \
+    do { sort_stats_t discard; stats_collect( &discard ); } while ( 0 )
+
+#else
+
+#define STAT_ADD( field, n )            ( (void) 0 )
+#define STAT_ALLOC( n )                 ( (void) 0 )
+#define STAT_TIMER( t )
+#define STAT_ELAPSED( t, field )        ( (void) 0 )
+#define STAT_LEVEL( l )
+#define STAT_SET_LEVEL( l )             ( (void) 0 )
+#define STAT_PARTITION( l, size, lt, gt ) ( (void) 0 )
+#define STAT_RESET()                    ( (void) 0 )
+#define stats_report( label, json )     ( (void) 0 )
+
+#endif
+
 /*
  * Helper functions (all static)
  */
 
+/// Pivot selection strategies (selected with -P)
+typedef enum {
+    PIVOT_FIRST,        ///< always data[0] (original behaviour)
+    PIVOT_MEDIAN,       ///< median-of-three / ninther by size
+    PIVOT_RANDOM        ///< element at a pseudo-random index
+} pivot_strategy_t;
+
+/// Partitions with at most this many elements pivot on the middle element
+#define PIVOT_SMALL   7
+/// Partitions larger than this use the ninther instead of median-of-three
+#define PIVOT_NINTHER 40
+
+static pivot_strategy_t pivot_strategy = PIVOT_MEDIAN;
+
+/// In-place partition kernels (selected with -K)
+typedef enum {
+    KERNEL_DUTCH,       ///< Dutch national flag loop (branchy)
+    KERNEL_BLOCK,       ///< branch-free block partition
+    KERNEL_SIMD         ///< vector partition, block if CPU lacks AVX2
+} partition_kernel_t;
+
+static partition_kernel_t partition_kernel = KERNEL_SIMD;
+
+/// Vector instruction sets usable on this CPU (set by simd_setup)
+typedef enum {
+    SIMD_NONE,
+    SIMD_AVX2,
+    SIMD_AVX512
+} simd_level_t;
+
+static simd_level_t simd_level = SIMD_NONE;
+
+/// Look for presorted runs before quicksorting (cleared by -R)
+static int adaptive_runs = 1;
+
+/// Elements classified per block by block_partition
+#define PARTITION_BLOCK 128
+
+/// Seed mixed into random pivot indices (set once in main)
+static unsigned long long pivot_seed = 0x9E3779B97F4A7C15ULL;
+
+/// Returns the median of a, b and c
+static int median3( int a, int b, int c )
+{
+    if ( a < b ) {
+        if ( b < c ) return b;
+        return a < c ? c : a;
+    }
+    if ( a < c ) return a;
+    return b < c ? c : b;
+}
+
+/// SplitMix64 finalizer, used to turn a partition's address and size
+/// into a random index without shared generator state between threads
+static unsigned long long mix64( unsigned long long x )
+{
+    x ^= x >> 30;  x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;  x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/// Chooses a pivot value for data[0, size) using pivot_strategy
+static int choose_pivot( size_t size, const int *data )
+{
+    switch ( pivot_strategy ) {
+        case PIVOT_FIRST:
+            return data[0];
+
+        case PIVOT_RANDOM: {
+            unsigned long long h = mix64( pivot_seed ^ (uintptr_t) data ^
+                                          ( (unsigned long long) size << 32 ) );
+            return data[ h % size ];
+        }
+
+        case PIVOT_MEDIAN:
+        default:
+            break;
+    }
+
+    size_t mid = size / 2;
+    if ( size <= PIVOT_SMALL )
+        return data[mid];
+
+    size_t last = size - 1;
+    if ( size <= PIVOT_NINTHER )
+        return median3( data[0], data[mid], data[last] );
+
+    size_t step = size / 8;
+    return median3( median3( data[0], data[step], data[2 * step] ),
+                    median3( data[mid - step], data[mid], data[mid + step] ),
+                    median3( data[last - 2 * step], data[last - step],
+                             data[last] ) );
+}
+
 /// Partitions array around pivot into less, same, and more lists
 static void partition_array( int pivot,
                              size_t size,
@@ -85,239 +422,5938 @@ static void partition_array( int pivot,
     }
 }
 
+/// Three-way in-place partition (Dutch national flag) around pivot.
+/// On return data[0, *lt) < pivot, data[*lt, *gt) == pivot and
+/// data[*gt, size) > pivot.
+static void partition3( int pivot, size_t size, int *data,
+                        size_t *lt, size_t *gt )
+{
+    size_t lo = 0, i = 0, hi = size;
+
+    while ( i < hi ) {
+        int v = data[i];
+        if ( v < pivot ) {
+            data[i++] = data[lo];
+            data[lo++] = v;
+        } else if ( v > pivot ) {
+            data[i] = data[--hi];
+            data[hi] = v;
+        } else {
+            i++;
+        }
+    }
+
+    STAT_ADD( comparisons, size );
+    STAT_ADD( moves, 2 * ( lo + ( size - hi ) ) );
+    *lt = lo;
+    *gt = hi;
+}
+
+/// Branch-free two-way block partition (Edelkamp & Weiss,
+/// BlockQuicksort).  Elements for which the predicate holds (x < pivot,
+/// or x <= pivot when or_equal is set) are moved to the front.
+/// Comparison results are only ever stored as offsets, never branched
+/// on; misplaced elements are then swapped in batches.
+/// @param eq_count if not NULL, incremented by the number of elements
+///        equal to pivot
+/// @return number of elements satisfying the predicate
+static size_t block_partition( int pivot, int or_equal, size_t size,
+                               int *data, size_t *eq_count )
+{
+    unsigned char off_l[PARTITION_BLOCK], off_r[PARTITION_BLOCK];
+    size_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+    size_t l = 0, r = size;
+    size_t eq = 0;
+
+    STAT_ADD( comparisons, size );
+    while ( r - l > 2 * PARTITION_BLOCK ) {
+        if ( num_l == 0 ) {
+            start_l = 0;
+            for ( size_t i = 0; i < PARTITION_BLOCK; i++ ) {
+                int v = data[l + i];
+                off_l[num_l] = (unsigned char) i;
+                num_l += !( ( v < pivot ) | ( or_equal & ( v == pivot ) ) );
+                eq += ( v == pivot );
+            }
+        }
+        if ( num_r == 0 ) {
+            start_r = 0;
+            for ( size_t i = 0; i < PARTITION_BLOCK; i++ ) {
+                int v = data[r - 1 - i];
+                off_r[num_r] = (unsigned char) i;
+                num_r += ( v < pivot ) | ( or_equal & ( v == pivot ) );
+                eq += ( v == pivot );
+            }
+        }
+
+        size_t num = num_l < num_r ? num_l : num_r;
+        STAT_ADD( moves, 2 * num );
+        for ( size_t j = 0; j < num; j++ ) {
+            size_t a = l + off_l[start_l + j];
+            size_t b = r - 1 - off_r[start_r + j];
+            int tmp = data[a];
+            data[a] = data[b];
+            data[b] = tmp;
+        }
+
+        num_l -= num;  num_r -= num;
+        start_l += num;  start_r += num;
+        if ( num_l == 0 ) l += PARTITION_BLOCK;
+        if ( num_r == 0 ) r -= PARTITION_BLOCK;
+    }
+
+    /* At most two blocks' worth is left.  A block with unswapped offsets
+     * was not consumed, so [l, r) still holds every element not yet
+     * placed; finish it with a plain Hoare-style scan.  Blocks already
+     * scanned above were counted in eq, the rest is counted here. */
+    size_t lo = l + ( num_l > 0 ? PARTITION_BLOCK : 0 );
+    size_t hi = r - ( num_r > 0 ? PARTITION_BLOCK : 0 );
+    for ( size_t k = lo; k < hi; k++ )
+        eq += ( data[k] == pivot );
+
+    size_t i = l, j = r;
+    for ( ;; ) {
+        while ( i < j && ( ( data[i] < pivot ) |
+                           ( or_equal & ( data[i] == pivot ) ) ) )
+            i++;
+        while ( i < j && !( ( data[j - 1] < pivot ) |
+                            ( or_equal & ( data[j - 1] == pivot ) ) ) )
+            j--;
+        if ( i >= j )
+            break;
+        int tmp = data[i];
+        data[i] = data[j - 1];
+        data[j - 1] = tmp;
+        STAT_ADD( moves, 2 );
+        i++;
+        j--;
+    }
+
+    if ( eq_count != NULL )
+        *eq_count += eq;
+    return i;
+}
+
+/*
+ * Vector partition and small-sort kernels (x86 AVX2 / AVX-512)
+ *
+ * Both partitions save the first and last vector, then repeatedly read
+ * one vector from whichever end has less free space, so that at least
+ * one vector's worth of room is free on each side.  Elements matching
+ * the predicate are packed to the left write cursor and the rest to the
+ * right one.  The final partial vector and the two saved vectors go
+ * through a scalar loop.
+ */
+
+/// Two-way partition kernel signature shared by the scalar and vector
+/// implementations (see block_partition)
+typedef size_t ( *partition2_fn )( int pivot, int or_equal, size_t size,
+                                   int *data, size_t *eq_count );
+
+#ifdef HAVE_X86_SIMD
+
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+/// AVX2 lane permutations: row m moves the lanes whose bit is set in m
+/// to the front (in order), followed by the remaining lanes
+static int avx2_compress_perm[256][8];
+
+/// Bitonic sorting network stages for one 16-lane (AVX-512) or 8-lane
+/// (AVX2) register: partner lane index and which lanes keep the max
+static int bitonic16_idx[10][16];
+static __mmask16 bitonic16_max[10];
+static int bitonic8_idx[6][8];
+static int bitonic8_max[6][8];
+
+/// Fills the bitonic stage tables for a register of the given width
+static void bitonic_tables( int width, int *idx, int *takes_max )
+{
+    int stage = 0;
+
+    for ( int k = 2; k <= width; k <<= 1 ) {
+        for ( int j = k >> 1; j > 0; j >>= 1, stage++ ) {
+            for ( int i = 0; i < width; i++ ) {
+                idx[stage * width + i] = i ^ j;
+                takes_max[stage * width + i] =
+                    ( ( i & j ) != 0 ) ^ ( ( i & k ) != 0 );
+            }
+        }
+    }
+}
+
+/// Detects AVX2/AVX-512 and builds the lookup tables (runs once)
+static void simd_init( void )
+{
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx512f" ) )
+        simd_level = SIMD_AVX512;
+    else if ( __builtin_cpu_supports( "avx2" ) )
+        simd_level = SIMD_AVX2;
+
+    for ( int m = 0; m < 256; m++ ) {
+        int n = 0;
+        for ( int i = 0; i < 8; i++ )
+            if ( m & ( 1 << i ) ) avx2_compress_perm[m][n++] = i;
+        for ( int i = 0; i < 8; i++ )
+            if ( !( m & ( 1 << i ) ) ) avx2_compress_perm[m][n++] = i;
+    }
+
+    int max16[10][16];
+    bitonic_tables( 16, &bitonic16_idx[0][0], &max16[0][0] );
+    for ( int s = 0; s < 10; s++ ) {
+        bitonic16_max[s] = 0;
+        for ( int i = 0; i < 16; i++ )
+            if ( max16[s][i] )
+                bitonic16_max[s] |= (__mmask16) ( 1u << i );
+    }
+
+    bitonic_tables( 8, &bitonic8_idx[0][0], &bitonic8_max[0][0] );
+    for ( int s = 0; s < 6; s++ )
+        for ( int i = 0; i < 8; i++ )
+            bitonic8_max[s][i] = -bitonic8_max[s][i];   // lane mask
+}
+
+/// Distributes the leftover elements of a vector partition: tmp holds
+/// every element not yet written, and [*left_w, *right_w) is exactly
+/// tmp_cnt free slots
+static size_t vector_partition_tail( int pivot, int or_equal,
+                                     const int *tmp, size_t tmp_cnt,
+                                     int *data, size_t left_w,
+                                     size_t right_w, size_t *eq )
+{
+    for ( size_t k = 0; k < tmp_cnt; k++ ) {
+        int x = tmp[k];
+        *eq += ( x == pivot );
+        if ( ( x < pivot ) | ( or_equal & ( x == pivot ) ) )
+            data[left_w++] = x;
+        else
+            data[--right_w] = x;
+    }
+    return left_w;
+}
+
+/// AVX-512 two-way partition using compress-stores (16 lanes)
+__attribute__(( target( "avx512f,popcnt" ) ))
+static size_t avx512_partition( int pivot, int or_equal, size_t size,
+                                int *data, size_t *eq_count )
+{
+    const size_t W = 16;
+    if ( size < 4 * W )
+        return block_partition( pivot, or_equal, size, data, eq_count );
+
+    STAT_ADD( comparisons, size );
+    STAT_ADD( moves, size );
+    __m512i vp = _mm512_set1_epi32( pivot );
+    __m512i first = _mm512_loadu_si512( data );
+    __m512i last  = _mm512_loadu_si512( data + size - W );
+    size_t left_w = 0, right_w = size, left_r = W, right_r = size - W;
+    size_t eq = 0;
+
+    while ( right_r - left_r >= W ) {
+        __m512i v;
+        if ( left_r - left_w <= right_w - right_r ) {
+            v = _mm512_loadu_si512( data + left_r );
+            left_r += W;
+        } else {
+            right_r -= W;
+            v = _mm512_loadu_si512( data + right_r );
+        }
+
+        __mmask16 m = or_equal ? _mm512_cmple_epi32_mask( v, vp )
+                               : _mm512_cmplt_epi32_mask( v, vp );
+        size_t cnt = (size_t) __builtin_popcount( m );
+        eq += (size_t) __builtin_popcount( _mm512_cmpeq_epi32_mask( v, vp ) );
+
+        _mm512_mask_compressstoreu_epi32( data + left_w, m, v );
+        left_w += cnt;
+        right_w -= W - cnt;
+        _mm512_mask_compressstoreu_epi32( data + right_w,
+                                          (__mmask16) ~m, v );
+    }
+
+    int tmp[3 * 16];
+    size_t rem = right_r - left_r;
+    memcpy( tmp, data + left_r, rem * sizeof( int ) );
+    _mm512_storeu_si512( tmp + rem, first );
+    _mm512_storeu_si512( tmp + rem + W, last );
+
+    left_w = vector_partition_tail( pivot, or_equal, tmp, rem + 2 * W,
+                                    data, left_w, right_w, &eq );
+    if ( eq_count != NULL )
+        *eq_count += eq;
+    return left_w;
+}
+
+/// AVX2 two-way partition using a lane-permutation table (8 lanes)
+__attribute__(( target( "avx2,popcnt" ) ))
+static size_t avx2_partition( int pivot, int or_equal, size_t size,
+                              int *data, size_t *eq_count )
+{
+    const size_t W = 8;
+    if ( size < 4 * W )
+        return block_partition( pivot, or_equal, size, data, eq_count );
+
+    STAT_ADD( comparisons, size );
+    STAT_ADD( moves, size );
+    __m256i vp = _mm256_set1_epi32( pivot );
+    __m256i first = _mm256_loadu_si256( (const __m256i *) data );
+    __m256i last  = _mm256_loadu_si256( (const __m256i *)
+                                        ( data + size - W ) );
+    size_t left_w = 0, right_w = size, left_r = W, right_r = size - W;
+    size_t eq = 0;
+
+    while ( right_r - left_r >= W ) {
+        __m256i v;
+        if ( left_r - left_w <= right_w - right_r ) {
+            v = _mm256_loadu_si256( (const __m256i *) ( data + left_r ) );
+            left_r += W;
+        } else {
+            right_r -= W;
+            v = _mm256_loadu_si256( (const __m256i *) ( data + right_r ) );
+        }
+
+        /* lanes that belong on the left: v < pivot (or v <= pivot) */
+        __m256i gt = _mm256_cmpgt_epi32( v, vp );
+        __m256i lt = _mm256_cmpgt_epi32( vp, v );
+        __m256i sel = or_equal ? _mm256_xor_si256( gt, _mm256_set1_epi32( -1 ) )
+                               : lt;
+        int m = _mm256_movemask_ps( _mm256_castsi256_ps( sel ) );
+        int e = _mm256_movemask_ps( _mm256_castsi256_ps(
+                                        _mm256_cmpeq_epi32( v, vp ) ) );
+        size_t cnt = (size_t) __builtin_popcount( (unsigned) m );
+        eq += (size_t) __builtin_popcount( (unsigned) e );
+
+        /* both ends have at least W free slots, so store whole vectors:
+         * the left store keeps its first cnt lanes, the right store its
+         * last W - cnt lanes */
+        __m256i perm = _mm256_loadu_si256( (const __m256i *)
+                                           avx2_compress_perm[m] );
+        __m256i packed = _mm256_permutevar8x32_epi32( v, perm );
+        _mm256_storeu_si256( (__m256i *) ( data + left_w ), packed );
+        _mm256_storeu_si256( (__m256i *) ( data + right_w - W ), packed );
+        left_w += cnt;
+        right_w -= W - cnt;
+    }
+
+    int tmp[3 * 8];
+    size_t rem = right_r - left_r;
+    memcpy( tmp, data + left_r, rem * sizeof( int ) );
+    _mm256_storeu_si256( (__m256i *) ( tmp + rem ), first );
+    _mm256_storeu_si256( (__m256i *) ( tmp + rem + W ), last );
+
+    left_w = vector_partition_tail( pivot, or_equal, tmp, rem + 2 * W,
+                                    data, left_w, right_w, &eq );
+    if ( eq_count != NULL )
+        *eq_count += eq;
+    return left_w;
+}
+
+/// Sorts up to 16 elements in one AVX-512 register (bitonic network,
+/// unused lanes padded with INT_MAX)
+__attribute__(( target( "avx512f" ) ))
+static void avx512_sort16( size_t size, int *data )
+{
+    __mmask16 live = (__mmask16) ( ( 1u << size ) - 1 );
+    __m512i v = _mm512_mask_loadu_epi32( _mm512_set1_epi32( INT_MAX ),
+                                         live, data );
+
+    for ( int s = 0; s < 10; s++ ) {
+        __m512i idx = _mm512_loadu_si512( bitonic16_idx[s] );
+        __m512i w = _mm512_permutexvar_epi32( idx, v );
+        v = _mm512_mask_blend_epi32( bitonic16_max[s],
+                                     _mm512_min_epi32( v, w ),
+                                     _mm512_max_epi32( v, w ) );
+    }
+
+    _mm512_mask_storeu_epi32( data, live, v );
+}
+
+/// Sorts up to 8 elements in one AVX2 register (bitonic network)
+__attribute__(( target( "avx2" ) ))
+static void avx2_sort8( size_t size, int *data )
+{
+    __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+    __m256i live = _mm256_cmpgt_epi32( _mm256_set1_epi32( (int) size ),
+                                       lane );
+    __m256i v = _mm256_blendv_epi8( _mm256_set1_epi32( INT_MAX ),
+                                    _mm256_maskload_epi32( data, live ),
+                                    live );
+
+    for ( int s = 0; s < 6; s++ ) {
+        __m256i idx = _mm256_loadu_si256( (const __m256i *) bitonic8_idx[s] );
+        __m256i hi  = _mm256_loadu_si256( (const __m256i *) bitonic8_max[s] );
+        __m256i w = _mm256_permutevar8x32_epi32( v, idx );
+        v = _mm256_blendv_epi8( _mm256_min_epi32( v, w ),
+                                _mm256_max_epi32( v, w ), hi );
+    }
+
+    _mm256_maskstore_epi32( data, live, v );
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/// Resolves the vector kernels for this CPU; safe to call repeatedly
+static void simd_setup( void )
+{
+#ifdef HAVE_X86_SIMD
+    pthread_once( &simd_once, simd_init );
+#endif
+}
+
+/// Returns the two-way partition kernel selected by partition_kernel
+static partition2_fn select_partition2( void )
+{
+#ifdef HAVE_X86_SIMD
+    if ( partition_kernel == KERNEL_SIMD ) {
+        if ( simd_level == SIMD_AVX512 ) return avx512_partition;
+        if ( simd_level == SIMD_AVX2 )   return avx2_partition;
+    }
+#endif
+    return block_partition;
+}
+
+/// Three-way partition from two passes of a two-way kernel: one pass
+/// splits off the elements below pivot; a second pass over the rest
+/// separates the ones equal to pivot, but only when duplicates of the
+/// pivot exist or the first pass made no progress.
+static void two_pass_partition3( partition2_fn split, int pivot,
+                                 size_t size, int *data,
+                                 size_t *lt, size_t *gt )
+{
+    size_t eq = 0;
+    size_t less = split( pivot, 0, size, data, &eq );
+
+    if ( eq > 1 || less == 0 ) {
+        *lt = less;
+        *gt = less + split( pivot, 1, size - less, data + less, NULL );
+    } else {
+        *lt = *gt = less;
+    }
+}
+
+/// Three-way partition using the kernel selected by partition_kernel
+static void partition_range( int pivot, size_t size, int *data,
+                             size_t *lt, size_t *gt )
+{
+    if ( partition_kernel == KERNEL_DUTCH )
+        partition3( pivot, size, data, lt, gt );
+    else
+        two_pass_partition3( select_partition2(), pivot, size, data,
+                             lt, gt );
+}
+
 /// Merges three sorted partitions into one newly allocated array
 static int *merge_partitions( size_t less_cnt, const int *less,
                               size_t same_cnt, const int *same,
                               size_t more_cnt, const int *more )
 {
-    size_t total = less_cnt + same_cnt + more_cnt;
-    int *result = malloc( total * sizeof( int ) );
+    size_t total = less_cnt + same_cnt + more_cnt;
+    int *result = malloc( total * sizeof( int ) );
+
+    if ( total > 0 && result == NULL ) {
+        perror( "malloc failed in merge_partitions" );
+        exit( EXIT_FAILURE );
+    }
+
+    memcpy( result,              less, less_cnt * sizeof( int ) );
+    memcpy( result + less_cnt,   same, same_cnt * sizeof( int ) );
+    memcpy( result + less_cnt + same_cnt, more, more_cnt * sizeof( int ) );
+
+    return result;
+}
+
+/// Output is staged in a buffer of this size and handed to fwrite
+#define OUTPUT_BUFFER_SIZE ( 1 << 16 )
+
+/// "00" "01" ... "99": two digits per table lookup when formatting
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/// Writes the decimal form of v to dst (no terminator)
+/// @return number of characters written (at most 11)
+static size_t format_int( char *dst, int v )
+{
+    char tmp[10];
+    char *p = tmp + sizeof( tmp );
+    unsigned u = v < 0 ? 0u - (unsigned) v : (unsigned) v;
+
+    while ( u >= 100 ) {
+        unsigned r = u % 100;
+        u /= 100;
+        p -= 2;
+        memcpy( p, digit_pairs + 2 * r, 2 );
+    }
+    if ( u >= 10 ) {
+        p -= 2;
+        memcpy( p, digit_pairs + 2 * u, 2 );
+    } else {
+        *--p = (char) ( '0' + u );
+    }
+
+    size_t len = (size_t) ( tmp + sizeof( tmp ) - p );
+    size_t sign = v < 0;
+    if ( sign )
+        dst[0] = '-';
+    memcpy( dst + sign, p, len );
+    return len + sign;
+}
+
+/// Writes arr to fp with sep between elements (none after the last),
+/// formatting into a large buffer flushed with fwrite (not reentrant:
+/// called from the main thread only)
+static void write_array_text( FILE *fp, const int *arr, size_t size,
+                              const char *sep )
+{
+    static char buf[OUTPUT_BUFFER_SIZE];
+    size_t sep_len = strlen( sep );
+    size_t used = 0;
+    for ( size_t i = 0; i < size; i++ ) {
+        if ( used + sep_len + 11 > OUTPUT_BUFFER_SIZE ) {
+            fwrite( buf, 1, used, fp );
+            used = 0;
+        }
+        if ( i > 0 ) {
+            memcpy( buf + used, sep, sep_len );
+            used += sep_len;
+        }
+        used += format_int( buf + used, arr[i] );
+    }
+    fwrite( buf, 1, used, fp );
+}
+
+/// Separator used by print_array (", ", or "\n" with -n)
+static const char *list_separator = ", ";
+
+/// Prints array as comma-separated values (no trailing comma or newline)
+static void print_array( const int *arr, size_t size )
+{
+    write_array_text( stdout, arr, size, list_separator );
+}
+
+/*
+ * Non-threaded recursive quicksort
+ */
+
+static int *recursive_quicksort( size_t size, const int *data );
+typedef struct pool_stats pool_stats_t;
+static int adaptive_sort( size_t size, int *data, size_t nthreads,
+                          pool_stats_t *stats );
+
+/// Partitions up to this size are finished by small_sort instead of
+/// being partitioned further
+#ifndef SMALL_SORT_CUTOFF
+#define SMALL_SORT_CUTOFF 16
+#endif
+
+/// Branch-free compare-exchange: leaves min in *a and max in *b
+static inline void cswap( int *a, int *b )
+{
+    int x = *a, y = *b;
+    *a = x < y ? x : y;
+    *b = x < y ? y : x;
+    STAT_ADD( comparisons, 1 );
+    STAT_ADD( moves, 2 );
+}
+
+/// Compare-exchange of two positions of data inside a sorting network
+#define CX( i, j ) cswap( &data[i], &data[j] )
+
+/*
+ * Batcher's merge-exchange networks (Knuth 5.2.2, Algorithm M) for 2
+ * to 16 elements, written out as fixed comparator sequences so every
+ * size is straight-line code.  The comparators on one line are
+ * independent of each other.
+ */
+
+static void sort_network_2( int *data )
+{
+    CX( 0, 1 );
+}
+
+static void sort_network_3( int *data )
+{
+    CX( 0, 2 );
+    CX( 0, 1 );
+    CX( 1, 2 );
+}
+
+static void sort_network_4( int *data )
+{
+    CX( 0, 2 ); CX( 1, 3 );
+    CX( 0, 1 ); CX( 2, 3 );
+    CX( 1, 2 );
+}
+
+static void sort_network_5( int *data )
+{
+    CX( 0, 4 );
+    CX( 0, 2 ); CX( 1, 3 );
+    CX( 2, 4 );
+    CX( 0, 1 ); CX( 2, 3 );
+    CX( 1, 4 );
+    CX( 1, 2 ); CX( 3, 4 );
+}
+
+static void sort_network_6( int *data )
+{
+    CX( 0, 4 ); CX( 1, 5 );
+    CX( 0, 2 ); CX( 1, 3 );
+    CX( 2, 4 ); CX( 3, 5 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 );
+    CX( 1, 4 );
+    CX( 1, 2 ); CX( 3, 4 );
+}
+
+static void sort_network_7( int *data )
+{
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 );
+    CX( 2, 4 ); CX( 3, 5 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 );
+    CX( 1, 4 ); CX( 3, 6 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 );
+}
+
+static void sort_network_8( int *data )
+{
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 );
+    CX( 2, 4 ); CX( 3, 5 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 );
+    CX( 1, 4 ); CX( 3, 6 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 );
+}
+
+static void sort_network_9( int *data )
+{
+    CX( 0, 8 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 );
+    CX( 4, 8 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 );
+    CX( 2, 8 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 );
+    CX( 1, 8 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 );
+}
+
+static void sort_network_10( int *data )
+{
+    CX( 0, 8 ); CX( 1, 9 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 );
+    CX( 4, 8 ); CX( 5, 9 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 );
+    CX( 2, 8 ); CX( 3, 9 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 ); CX( 7, 9 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 ); CX( 8, 9 );
+    CX( 1, 8 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 );
+}
+
+static void sort_network_11( int *data )
+{
+    CX( 0, 8 ); CX( 1, 9 ); CX( 2, 10 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 );
+    CX( 4, 8 ); CX( 5, 9 ); CX( 6, 10 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 ); CX( 8, 10 );
+    CX( 2, 8 ); CX( 3, 9 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 ); CX( 7, 9 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 ); CX( 8, 9 );
+    CX( 1, 8 ); CX( 3, 10 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 ); CX( 7, 10 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 ); CX( 9, 10 );
+}
+
+static void sort_network_12( int *data )
+{
+    CX( 0, 8 ); CX( 1, 9 ); CX( 2, 10 ); CX( 3, 11 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 );
+    CX( 4, 8 ); CX( 5, 9 ); CX( 6, 10 ); CX( 7, 11 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 ); CX( 8, 10 );
+    CX( 9, 11 );
+    CX( 2, 8 ); CX( 3, 9 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 ); CX( 7, 9 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 ); CX( 8, 9 );
+    CX( 10, 11 );
+    CX( 1, 8 ); CX( 3, 10 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 ); CX( 7, 10 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 ); CX( 9, 10 );
+}
+
+static void sort_network_13( int *data )
+{
+    CX( 0, 8 ); CX( 1, 9 ); CX( 2, 10 ); CX( 3, 11 ); CX( 4, 12 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 ); CX( 8, 12 );
+    CX( 4, 8 ); CX( 5, 9 ); CX( 6, 10 ); CX( 7, 11 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 ); CX( 8, 10 );
+    CX( 9, 11 );
+    CX( 2, 8 ); CX( 3, 9 ); CX( 6, 12 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 ); CX( 7, 9 ); CX( 10, 12 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 ); CX( 8, 9 );
+    CX( 10, 11 );
+    CX( 1, 8 ); CX( 3, 10 ); CX( 5, 12 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 ); CX( 7, 10 ); CX( 9, 12 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 ); CX( 9, 10 );
+    CX( 11, 12 );
+}
+
+static void sort_network_14( int *data )
+{
+    CX( 0, 8 ); CX( 1, 9 ); CX( 2, 10 ); CX( 3, 11 ); CX( 4, 12 );
+    CX( 5, 13 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 ); CX( 8, 12 );
+    CX( 9, 13 );
+    CX( 4, 8 ); CX( 5, 9 ); CX( 6, 10 ); CX( 7, 11 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 ); CX( 8, 10 );
+    CX( 9, 11 );
+    CX( 2, 8 ); CX( 3, 9 ); CX( 6, 12 ); CX( 7, 13 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 ); CX( 7, 9 ); CX( 10, 12 );
+    CX( 11, 13 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 ); CX( 8, 9 );
+    CX( 10, 11 ); CX( 12, 13 );
+    CX( 1, 8 ); CX( 3, 10 ); CX( 5, 12 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 ); CX( 7, 10 ); CX( 9, 12 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 ); CX( 9, 10 );
+    CX( 11, 12 );
+}
+
+static void sort_network_15( int *data )
+{
+    CX( 0, 8 ); CX( 1, 9 ); CX( 2, 10 ); CX( 3, 11 ); CX( 4, 12 );
+    CX( 5, 13 ); CX( 6, 14 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 ); CX( 8, 12 );
+    CX( 9, 13 ); CX( 10, 14 );
+    CX( 4, 8 ); CX( 5, 9 ); CX( 6, 10 ); CX( 7, 11 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 ); CX( 8, 10 );
+    CX( 9, 11 ); CX( 12, 14 );
+    CX( 2, 8 ); CX( 3, 9 ); CX( 6, 12 ); CX( 7, 13 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 ); CX( 7, 9 ); CX( 10, 12 );
+    CX( 11, 13 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 ); CX( 8, 9 );
+    CX( 10, 11 ); CX( 12, 13 );
+    CX( 1, 8 ); CX( 3, 10 ); CX( 5, 12 ); CX( 7, 14 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 ); CX( 7, 10 ); CX( 9, 12 );
+    CX( 11, 14 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 ); CX( 9, 10 );
+    CX( 11, 12 ); CX( 13, 14 );
+}
+
+static void sort_network_16( int *data )
+{
+    CX( 0, 8 ); CX( 1, 9 ); CX( 2, 10 ); CX( 3, 11 ); CX( 4, 12 );
+    CX( 5, 13 ); CX( 6, 14 ); CX( 7, 15 );
+    CX( 0, 4 ); CX( 1, 5 ); CX( 2, 6 ); CX( 3, 7 ); CX( 8, 12 );
+    CX( 9, 13 ); CX( 10, 14 ); CX( 11, 15 );
+    CX( 4, 8 ); CX( 5, 9 ); CX( 6, 10 ); CX( 7, 11 );
+    CX( 0, 2 ); CX( 1, 3 ); CX( 4, 6 ); CX( 5, 7 ); CX( 8, 10 );
+    CX( 9, 11 ); CX( 12, 14 ); CX( 13, 15 );
+    CX( 2, 8 ); CX( 3, 9 ); CX( 6, 12 ); CX( 7, 13 );
+    CX( 2, 4 ); CX( 3, 5 ); CX( 6, 8 ); CX( 7, 9 ); CX( 10, 12 );
+    CX( 11, 13 );
+    CX( 0, 1 ); CX( 2, 3 ); CX( 4, 5 ); CX( 6, 7 ); CX( 8, 9 );
+    CX( 10, 11 ); CX( 12, 13 ); CX( 14, 15 );
+    CX( 1, 8 ); CX( 3, 10 ); CX( 5, 12 ); CX( 7, 14 );
+    CX( 1, 4 ); CX( 3, 6 ); CX( 5, 8 ); CX( 7, 10 ); CX( 9, 12 );
+    CX( 11, 14 );
+    CX( 1, 2 ); CX( 3, 4 ); CX( 5, 6 ); CX( 7, 8 ); CX( 9, 10 );
+    CX( 11, 12 ); CX( 13, 14 );
+}
+
+#undef CX
+
+/// Straight insertion sort for short partitions
+static void insertion_sort( size_t size, int *data )
+{
+    for ( size_t i = 1; i < size; i++ ) {
+        int v = data[i];
+        size_t j = i;
+        while ( j > 0 && v < data[j - 1] ) {
+            data[j] = data[j - 1];
+            j--;
+        }
+        data[j] = v;
+        STAT_ADD( comparisons, i - j + ( j > 0 ) );
+        STAT_ADD( moves, i - j + 1 );
+    }
+}
+
+/// Sorts a partition of at most SMALL_SORT_CUTOFF elements: an
+/// in-register vector sort when the SIMD kernel is active, otherwise a
+/// fixed sorting network per size up to 16, insertion sort above
+static void small_sort( size_t size, int *data )
+{
+#ifdef HAVE_X86_SIMD
+    if ( partition_kernel == KERNEL_SIMD && size > 1 ) {
+        if ( simd_level == SIMD_AVX512 && size <= 16 ) {
+            avx512_sort16( size, data );
+            STAT_ADD( moves, size );
+            return;
+        }
+        if ( simd_level >= SIMD_AVX2 && size <= 8 ) {
+            avx2_sort8( size, data );
+            STAT_ADD( moves, size );
+            return;
+        }
+    }
+#endif
+
+    switch ( size ) {
+        case 0: case 1: return;
+        case 2:  sort_network_2( data );  return;
+        case 3:  sort_network_3( data );  return;
+        case 4:  sort_network_4( data );  return;
+        case 5:  sort_network_5( data );  return;
+        case 6:  sort_network_6( data );  return;
+        case 7:  sort_network_7( data );  return;
+        case 8:  sort_network_8( data );  return;
+        case 9:  sort_network_9( data );  return;
+        case 10: sort_network_10( data ); return;
+        case 11: sort_network_11( data ); return;
+        case 12: sort_network_12( data ); return;
+        case 13: sort_network_13( data ); return;
+        case 14: sort_network_14( data ); return;
+        case 15: sort_network_15( data ); return;
+        case 16: sort_network_16( data ); return;
+        default: insertion_sort( size, data ); return;
+    }
+}
+
+/// Restores the max-heap property below node root of data[0, size)
+static void sift_down( int *data, size_t root, size_t size )
+{
+    int v = data[root];
+
+    for ( ;; ) {
+        size_t child = 2 * root + 1;
+        if ( child >= size )
+            break;
+        if ( child + 1 < size && data[child] < data[child + 1] )
+            child++;
+        STAT_ADD( comparisons, 2 );
+        if ( !( v < data[child] ) )
+            break;
+        data[root] = data[child];
+        STAT_ADD( moves, 1 );
+        root = child;
+    }
+    data[root] = v;
+    STAT_ADD( moves, 1 );
+}
+
+/// Heapsort, the O(n log n) fallback when quicksort runs too deep
+static void heap_sort( size_t size, int *data )
+{
+    if ( size <= 1 )
+        return;
+
+    STAT_TIMER( t_heap );
+    for ( size_t i = size / 2; i-- > 0; )
+        sift_down( data, i, size );
+
+    for ( size_t end = size - 1; end > 0; end-- ) {
+        int top = data[0];
+        data[0] = data[end];
+        data[end] = top;
+        sift_down( data, 0, end );
+    }
+    STAT_ELAPSED( t_heap, leaf_time );
+}
+
+/// Depth budget for introsort: 2 * floor(log2(size))
+static unsigned depth_limit( size_t size )
+{
+    unsigned depth = 0;
+
+    while ( size > 1 ) {
+        size >>= 1;
+        depth += 2;
+    }
+    return depth;
+}
+
+/// Returns nonzero when a partition of size elements into lt below and
+/// more above the pivot is badly unbalanced: the smaller side holds
+/// under an eighth of the elements that are not copies of the pivot
+static inline int bad_partition( size_t size, size_t lt, size_t gt )
+{
+    size_t more = size - gt;
+    size_t smaller = lt < more ? lt : more;
+    return smaller < ( lt + more ) / 8;
+}
+
+/// pdqsort's pattern breaker: after a bad partition, swaps a few
+/// elements near the quarter points of each side with its ends, so
+/// the input pattern that fooled the pivot choice (sorted runs, organ
+/// pipes, first-element pivots) does not repeat on the next level
+static void break_patterns( size_t size, int *data )
+{
+    if ( size <= SMALL_SORT_CUTOFF )
+        return;
+
+    static const size_t near[3] = { 0, 1, 2 };
+    size_t q = size / 4;
+    size_t swaps = size > 128 ? 3 : 1;
+
+    for ( size_t k = 0; k < swaps; k++ ) {
+        size_t lo = near[k], hi = size - 1 - near[k];
+        int t = data[lo];
+        data[lo] = data[q + lo];
+        data[q + lo] = t;
+        t = data[hi];
+        data[hi] = data[hi - q];
+        data[hi - q] = t;
+    }
+}
+
+/// Introsort: three-way quicksort that recurses on the smaller side and
+/// loops on the larger (O(log n) stack), switching the current partition
+/// to heapsort once depth_left partitioning levels have been used up and
+/// finishing partitions of SMALL_SORT_CUTOFF or fewer with small_sort
+/// @param size number of elements
+/// @param data array to sort
+/// @param depth_left remaining partitioning levels before heapsort
+static void introsort_loop( size_t size, int *data, unsigned depth_left )
+{
+    STAT_LEVEL( level );
+
+    while ( size > SMALL_SORT_CUTOFF ) {
+        if ( depth_left == 0 ) {
+            heap_sort( size, data );
+            return;
+        }
+        depth_left--;
+
+        size_t lt, gt;
+        STAT_TIMER( t_part );
+        partition_range( choose_pivot( size, data ), size, data, &lt, &gt );
+        STAT_ELAPSED( t_part, partition_time );
+        STAT_PARTITION( level++, size, lt, gt );
+        if ( bad_partition( size, lt, gt ) ) {
+            break_patterns( lt, data );
+            break_patterns( size - gt, data + gt );
+        }
+
+        size_t more_cnt = size - gt;
+        STAT_SET_LEVEL( level );
+        if ( lt < more_cnt ) {
+            introsort_loop( lt, data, depth_left );
+            data += gt;
+            size = more_cnt;
+        } else {
+            introsort_loop( more_cnt, data + gt, depth_left );
+            size = lt;
+        }
+    }
+
+    STAT_TIMER( t_leaf );
+    small_sort( size, data );
+    STAT_ELAPSED( t_leaf, leaf_time );
+}
+
+/// Sorts data in place (introsort with three-way partitioning)
+/// @param size number of elements
+/// @param data array to sort
+static void sort_in_place( size_t size, int *data )
+{
+    STAT_SET_LEVEL( 0 );
+    introsort_loop( size, data, depth_limit( size ) );
+}
+
+/// Public entry point for non-threaded quicksort (resets thread counter)
+/// @param size number of elements
+/// @param data original array
+/// @return newly allocated sorted array (caller must free)
+int *quicksort( size_t size, const int *data )
+{
+    int *result = malloc( size * sizeof( int ) );
+    if ( size > 0 && result == NULL ) {
+        perror( "malloc failed in quicksort" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( size * sizeof( int ) );
+    memcpy( result, data, size * sizeof( int ) );
+
+    simd_setup();
+    if ( !adaptive_sort( size, result, 1, NULL ) )
+        sort_in_place( size, result );
+    return result;
+}
+
+/// Original allocating quicksort (new arrays at every level), kept
+/// for benchmarking against the in-place version
+/// @param size number of elements
+/// @param data original array
+/// @return newly allocated sorted array (caller must free)
+int *legacy_quicksort( size_t size, const int *data )
+{
+    return recursive_quicksort( size, data );
+}
+
+static int *recursive_quicksort( size_t size, const int *data )
+{
+    if ( size <= 1 ) {
+        int *res = malloc( size * sizeof( int ) );
+        if ( size == 1 ) res[0] = data[0];
+        return res;
+    }
+
+    int pivot = data[0];
+    size_t less_cnt, same_cnt, more_cnt;
+    int *less = NULL, *same = NULL, *more = NULL;
+
+    partition_array( pivot, size, data,
+                     &less_cnt, &less, &same_cnt, &same, &more_cnt, &more );
+
+    int *sorted_less = recursive_quicksort( less_cnt, less );
+    int *sorted_more = recursive_quicksort( more_cnt, more );
+
+    int *result = merge_partitions( less_cnt, sorted_less,
+                                    same_cnt, same,
+                                    more_cnt, sorted_more );
+
+    free( less );  free( same );  free( more );
+    free( sorted_less );
+    free( sorted_more );
+
+    return result;
+}
+
+/*
+ * Parallel in-place partition
+ *
+ * Used for partitions too large for one core to split quickly (the top
+ * levels of the threaded sorts).  Each thread partitions its own chunk
+ * with the sequential kernel; afterwards every chunk is [left | right].
+ * The right-going elements that landed before the global split point
+ * and the left-going ones after it are equal in number, so they are
+ * swapped pairwise, each thread taking an equal share of the pairs.
+ *
+ * Inside the threaded sort both phases run as tasks on the sort's own
+ * work-stealing pool (pool_fork_join), so no threads are started per
+ * partition; elsewhere they run through parallel_run.
+ */
+
+/// Body of one piece of a data-parallel phase: called once per id
+typedef void ( *piece_fn )( void *arg, size_t id, size_t npieces );
+
+typedef struct sort_pool sort_pool_t;
+static void pool_fork_join( sort_pool_t *pool, size_t worker,
+                            size_t npieces, piece_fn fn, void *arg );
+static void parallel_run( size_t nthreads, piece_fn fn, void *arg );
+
+/// Partitions at least this large are split by several threads
+#define PARALLEL_PARTITION_MIN ( 1 << 20 )
+
+/// Smallest chunk a parallel partition hands to one thread
+#define PARALLEL_PARTITION_CHUNK ( 1 << 18 )
+
+/// A run of misplaced elements: data[start, start + len)
+typedef struct {
+    size_t start;
+    size_t len;
+} misplaced_run_t;
+
+/// Shared state of one parallel two-way partition
+typedef struct {
+    partition2_fn    split;
+    int              pivot;
+    int              or_equal;
+    size_t           size;
+    int             *data;
+    size_t          *left_cnt;  ///< per-chunk count of left elements
+    size_t          *eq_cnt;    ///< per-chunk count of pivot copies
+    misplaced_run_t *runs[2];   ///< right-goers in left region, and
+                                ///< left-goers in right region
+    size_t           nruns[2];
+    size_t           misplaced; ///< elements in each of runs[0], runs[1]
+} ppart_job_t;
+
+/// Phase 1: partition chunk id with the sequential kernel
+static void ppart_local( void *arg, size_t id, size_t nthreads )
+{
+    ppart_job_t *job = (ppart_job_t *) arg;
+    size_t lo = job->size * id / nthreads;
+    size_t hi = job->size * ( id + 1 ) / nthreads;
+
+    job->eq_cnt[id] = 0;
+    job->left_cnt[id] = job->split( job->pivot, job->or_equal, hi - lo,
+                                    job->data + lo, &job->eq_cnt[id] );
+}
+
+/// Returns the data index of the k-th element of a list of runs
+static size_t run_index( const misplaced_run_t *runs, size_t *r, size_t *k )
+{
+    while ( *k >= runs[*r].len ) {
+        *k -= runs[*r].len;
+        ( *r )++;
+    }
+    return runs[*r].start + *k;
+}
+
+/// Phase 2: swap this thread's share of the misplaced pairs
+static void ppart_swap( void *arg, size_t id, size_t nthreads )
+{
+    ppart_job_t *job = (ppart_job_t *) arg;
+    size_t k0 = job->misplaced * id / nthreads;
+    size_t k1 = job->misplaced * ( id + 1 ) / nthreads;
+    size_t ra = 0, rb = 0, ka = k0, kb = k0;
+
+    if ( k0 >= k1 )
+        return;
+
+    size_t ia = run_index( job->runs[0], &ra, &ka );
+    size_t ib = run_index( job->runs[1], &rb, &kb );
+    STAT_ADD( moves, 2 * ( k1 - k0 ) );
+    for ( size_t k = k0; k < k1; k++ ) {
+        int tmp = job->data[ia];
+        job->data[ia] = job->data[ib];
+        job->data[ib] = tmp;
+
+        if ( ++ka == job->runs[0][ra].len && k + 1 < k1 ) {
+            ka = 0;
+            ra++;
+        }
+        if ( ++kb == job->runs[1][rb].len && k + 1 < k1 ) {
+            kb = 0;
+            rb++;
+        }
+        ia = job->runs[0][ra].start + ka;
+        ib = job->runs[1][rb].start + kb;
+    }
+}
+
+/// Runs one phase of a parallel partition on nthreads pieces: as pool
+/// tasks when called from pool worker `worker`, else on new threads
+static void ppart_phase( sort_pool_t *pool, size_t worker, size_t nthreads,
+                         piece_fn fn, void *arg )
+{
+    if ( pool != NULL )
+        pool_fork_join( pool, worker, nthreads, fn, arg );
+    else
+        parallel_run( nthreads, fn, arg );
+}
+
+/// Two-way partition of data[0, size) in nthreads pieces; same
+/// contract as block_partition
+/// @param pool pool of the calling worker, or NULL outside the pool
+/// @param worker id of the calling worker (ignored without a pool)
+static size_t parallel_partition2( sort_pool_t *pool, size_t worker,
+                                   partition2_fn split, size_t nthreads,
+                                   int pivot, int or_equal, size_t size,
+                                   int *data, size_t *eq_count )
+{
+    ppart_job_t job;
+    job.split = split;
+    job.pivot = pivot;
+    job.or_equal = or_equal;
+    job.size = size;
+    job.data = data;
+    job.left_cnt = malloc( nthreads * sizeof( size_t ) );
+    job.eq_cnt = malloc( nthreads * sizeof( size_t ) );
+    job.runs[0] = malloc( nthreads * sizeof( misplaced_run_t ) );
+    job.runs[1] = malloc( nthreads * sizeof( misplaced_run_t ) );
+    if ( job.left_cnt == NULL || job.eq_cnt == NULL ||
+         job.runs[0] == NULL || job.runs[1] == NULL ) {
+        perror( "malloc failed in parallel_partition2" );
+        exit( EXIT_FAILURE );
+    }
+
+    ppart_phase( pool, worker, nthreads, ppart_local, &job );
+
+    size_t split_at = 0;
+    for ( size_t t = 0; t < nthreads; t++ ) {
+        split_at += job.left_cnt[t];
+        if ( eq_count != NULL )
+            *eq_count += job.eq_cnt[t];
+    }
+
+    /* collect the runs on the wrong side of split_at */
+    job.nruns[0] = job.nruns[1] = 0;
+    job.misplaced = 0;
+    for ( size_t t = 0; t < nthreads; t++ ) {
+        size_t lo = size * t / nthreads;
+        size_t hi = size * ( t + 1 ) / nthreads;
+        size_t mid = lo + job.left_cnt[t];
+
+        size_t r_end = hi < split_at ? hi : split_at;       // right-goers
+        if ( mid < r_end ) {
+            job.runs[0][ job.nruns[0]++ ] =
+                (misplaced_run_t) { mid, r_end - mid };
+            job.misplaced += r_end - mid;
+        }
+        size_t l_start = lo > split_at ? lo : split_at;     // left-goers
+        if ( l_start < mid )
+            job.runs[1][ job.nruns[1]++ ] =
+                (misplaced_run_t) { l_start, mid - l_start };
+    }
+
+    if ( job.misplaced > 0 )
+        ppart_phase( pool, worker, nthreads, ppart_swap, &job );
+
+    free( job.left_cnt );
+    free( job.eq_cnt );
+    free( job.runs[0] );
+    free( job.runs[1] );
+
+    return split_at;
+}
+
+/// Three-way partition in nthreads pieces (see two_pass_partition3)
+/// @param pool pool of the calling worker, or NULL outside the pool
+/// @param worker id of the calling worker (ignored without a pool)
+static void parallel_partition3( sort_pool_t *pool, size_t worker,
+                                 size_t nthreads, int pivot, size_t size,
+                                 int *data, size_t *lt, size_t *gt )
+{
+    partition2_fn split = select_partition2();
+    size_t eq = 0;
+    size_t less = parallel_partition2( pool, worker, split, nthreads, pivot,
+                                       0, size, data, &eq );
+
+    if ( eq > 1 || less == 0 ) {
+        *lt = less;
+        *gt = less + parallel_partition2( pool, worker, split, nthreads,
+                                          pivot, 1, size - less,
+                                          data + less, NULL );
+    } else {
+        *lt = *gt = less;
+    }
+}
+
+/*
+ * Threaded quicksort (work-stealing pool)
+ */
+
+/// Partitions at or below this size are sorted inline by the worker
+/// that holds them instead of being split into further tasks
+#define SEQUENTIAL_CUTOFF 4096
+
+/// One fork-join phase whose pieces run as pool tasks (pool_fork_join)
+typedef struct {
+    piece_fn         fn;
+    void            *arg;
+    size_t           npieces;
+    volatile size_t  remaining; ///< pieces pushed but not yet finished
+} pool_join_t;
+
+/// One unit of work: sort data[0, size) in place, or run one piece of
+/// a fork-join phase
+typedef struct {
+    int         *data;
+    size_t       size;
+    unsigned     depth_left;    ///< introsort budget left for this range
+    unsigned     level;         ///< partitions above this range (statistics)
+    pool_join_t *join;          ///< phase this piece belongs to, or NULL
+    size_t       piece;         ///< piece id within join
+} sort_task_t;
+
+/// Per-worker double-ended task queue.  The owner pushes and pops at
+/// the tail; thieves take from the head (the oldest, largest tasks).
+typedef struct {
+    pthread_mutex_t lock;
+    sort_task_t    *tasks;      ///< ring storage
+    size_t          head;       ///< index of oldest task
+    size_t          count;      ///< number of queued tasks
+    size_t          capacity;   ///< allocated slots
+    unsigned long   executed;   ///< tasks this worker ran
+    unsigned long   steals;     ///< tasks this worker stole
+} worker_deque_t;
+
+/// Shared state of one pool run
+struct sort_pool {
+    size_t           nworkers;
+    size_t           total;     ///< elements in all initial tasks
+    worker_deque_t  *deques;
+    volatile size_t  pending;   ///< tasks pushed but not yet finished
+    volatile size_t  queued;    ///< tasks sitting in some deque
+    pthread_mutex_t  idle_lock;
+    pthread_cond_t   idle_cond;
+};
+
+/// Argument handed to each pool thread
+typedef struct {
+    sort_pool_t *pool;
+    size_t       id;
+} worker_args_t;
+
+/// Statistics reported after a threaded sort
+struct pool_stats {
+    size_t        workers;
+    unsigned long tasks;
+    unsigned long steals;
+};
+
+/// Returns the number of online CPUs (at least 1)
+static size_t online_cpus( void )
+{
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? (size_t) n : 1;
+}
+
+/// Pushes a task on the tail of worker id's deque and wakes idle workers
+static void pool_push( sort_pool_t *pool, size_t id, sort_task_t task )
+{
+    worker_deque_t *dq = &pool->deques[id];
+
+    __sync_fetch_and_add( &pool->pending, 1 );
+
+    pthread_mutex_lock( &dq->lock );
+    if ( dq->count == dq->capacity ) {
+        size_t new_cap = dq->capacity ? dq->capacity * 2 : 64;
+        sort_task_t *grown = malloc( new_cap * sizeof( sort_task_t ) );
+        if ( grown == NULL ) {
+            perror( "malloc failed in pool_push" );
+            exit( EXIT_FAILURE );
+        }
+        for ( size_t i = 0; i < dq->count; i++ )
+            grown[i] = dq->tasks[ ( dq->head + i ) % dq->capacity ];
+        free( dq->tasks );
+        dq->tasks = grown;
+        dq->head = 0;
+        dq->capacity = new_cap;
+    }
+    dq->tasks[ ( dq->head + dq->count ) % dq->capacity ] = task;
+    dq->count++;
+    pthread_mutex_unlock( &dq->lock );
+
+    __sync_fetch_and_add( &pool->queued, 1 );
+
+    pthread_mutex_lock( &pool->idle_lock );
+    pthread_cond_broadcast( &pool->idle_cond );
+    pthread_mutex_unlock( &pool->idle_lock );
+}
+
+/// Takes a task from the tail (own == 1) or head (own == 0) of a deque
+/// @return 1 if a task was taken, 0 if the deque was empty
+static int deque_take( worker_deque_t *dq, int own, sort_task_t *out )
+{
+    int found = 0;
+
+    pthread_mutex_lock( &dq->lock );
+    if ( dq->count > 0 ) {
+        if ( own ) {
+            *out = dq->tasks[ ( dq->head + dq->count - 1 ) % dq->capacity ];
+        } else {
+            *out = dq->tasks[ dq->head ];
+            dq->head = ( dq->head + 1 ) % dq->capacity;
+        }
+        dq->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock( &dq->lock );
+
+    return found;
+}
+
+/// Finds work for worker id: own deque first, then steal round-robin
+static int pool_find_task( sort_pool_t *pool, size_t id, sort_task_t *out )
+{
+    if ( deque_take( &pool->deques[id], 1, out ) )
+        goto found;
+
+    for ( size_t k = 1; k < pool->nworkers; k++ ) {
+        size_t victim = ( id + k ) % pool->nworkers;
+        if ( deque_take( &pool->deques[victim], 0, out ) ) {
+            pool->deques[id].steals++;
+            goto found;
+        }
+    }
+    return 0;
+
+found:
+    __sync_fetch_and_sub( &pool->queued, 1 );
+    return 1;
+}
+
+/// Retires a finished task, waking idle workers when it was the last
+static void pool_finish( sort_pool_t *pool )
+{
+    if ( __sync_sub_and_fetch( &pool->pending, 1 ) == 0 ) {
+        pthread_mutex_lock( &pool->idle_lock );
+        pthread_cond_broadcast( &pool->idle_cond );
+        pthread_mutex_unlock( &pool->idle_lock );
+    }
+}
+
+/// Runs one piece of a fork-join phase and retires it.  join lives on
+/// the forking worker's stack, so it is not touched after the count.
+static void pool_run_piece( sort_pool_t *pool, sort_task_t task )
+{
+    pool_join_t *join = task.join;
+
+    join->fn( join->arg, task.piece, join->npieces );
+    __sync_fetch_and_sub( &join->remaining, 1 );
+    pool_finish( pool );
+}
+
+/// Takes the tail task of a deque only if it is a piece of join
+static int deque_take_piece( worker_deque_t *dq, const pool_join_t *join,
+                             sort_task_t *out )
+{
+    int found = 0;
+
+    pthread_mutex_lock( &dq->lock );
+    if ( dq->count > 0 ) {
+        sort_task_t *tail =
+            &dq->tasks[ ( dq->head + dq->count - 1 ) % dq->capacity ];
+        if ( tail->join == join ) {
+            *out = *tail;
+            dq->count--;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock( &dq->lock );
+
+    return found;
+}
+
+/// Runs fn( arg, id, npieces ) for id = 0 .. npieces-1 from inside pool
+/// worker `worker`.  Pieces 1 .. npieces-1 go on the worker's own deque,
+/// where idle workers steal them; the worker runs piece 0, then takes
+/// back whatever nobody stole and waits for the rest.  Only the forking
+/// worker pushes to its deque, so its unstolen pieces are always at the
+/// tail.  When the other workers are busy the phase simply runs on
+/// fewer threads.
+static void pool_fork_join( sort_pool_t *pool, size_t worker,
+                            size_t npieces, piece_fn fn, void *arg )
+{
+    pool_join_t join = { fn, arg, npieces, npieces - 1 };
+    sort_task_t task;
+
+    for ( size_t i = 1; i < npieces; i++ )
+        pool_push( pool, worker,
+                   (sort_task_t) { NULL, 0, 0, 0, &join, i } );
+
+    fn( arg, 0, npieces );
+    while ( deque_take_piece( &pool->deques[worker], &join, &task ) ) {
+        __sync_fetch_and_sub( &pool->queued, 1 );
+        pool_run_piece( pool, task );
+    }
+
+    /* stolen pieces are single partition passes: wait them out */
+    while ( join.remaining > 0 )
+        sched_yield();
+    __sync_synchronize();
+}
+
+/// Sorts one task, splitting off the larger side of every partition as
+/// a new task until what is left falls under SEQUENTIAL_CUTOFF
+static void run_sort_task( sort_pool_t *pool, size_t id, sort_task_t task )
+{
+    int *data = task.data;
+    size_t size = task.size;
+    unsigned depth_left = task.depth_left;
+    unsigned level = task.level;
+
+    while ( size > SEQUENTIAL_CUTOFF ) {
+        if ( depth_left == 0 ) {
+            heap_sort( size, data );
+            return;
+        }
+        depth_left--;
+
+        /* large partitions get a share of the pool proportional to
+         * their part of the whole input */
+        size_t lt, gt;
+        size_t helpers = (size_t) ( (double) pool->nworkers * size /
+                                    pool->total + 0.5 );
+        if ( helpers > size / PARALLEL_PARTITION_CHUNK )
+            helpers = size / PARALLEL_PARTITION_CHUNK;
+
+        STAT_TIMER( t_part );
+        if ( size >= PARALLEL_PARTITION_MIN && helpers > 1 &&
+             partition_kernel != KERNEL_DUTCH )
+            parallel_partition3( pool, id, helpers,
+                                 choose_pivot( size, data ), size, data,
+                                 &lt, &gt );
+        else
+            partition_range( choose_pivot( size, data ), size, data,
+                             &lt, &gt );
+        STAT_ELAPSED( t_part, partition_time );
+        STAT_PARTITION( level, size, lt, gt );
+        if ( bad_partition( size, lt, gt ) ) {
+            break_patterns( lt, data );
+            break_patterns( size - gt, data + gt );
+        }
+
+        level++;
+        sort_task_t low  = { data, lt, depth_left, level, NULL, 0 };
+        sort_task_t high = { data + gt, size - gt, depth_left, level,
+                             NULL, 0 };
+        sort_task_t keep = low, give = high;
+        if ( low.size > high.size ) {
+            keep = high;
+            give = low;
+        }
+
+        if ( give.size > 1 )
+            pool_push( pool, id, give );
+        data = keep.data;
+        size = keep.size;
+    }
+
+    STAT_SET_LEVEL( level );
+    introsort_loop( size, data, depth_left );
+}
+
+/// Pool thread body: run tasks until nothing is pending anywhere
+static void *pool_worker( void *arg )
+{
+    worker_args_t *wa = (worker_args_t *) arg;
+    sort_pool_t *pool = wa->pool;
+    size_t id = wa->id;
+    sort_task_t task;
+
+    for ( ;; ) {
+        if ( pool_find_task( pool, id, &task ) ) {
+            if ( task.join != NULL ) {
+                pool_run_piece( pool, task );
+                continue;
+            }
+            run_sort_task( pool, id, task );
+            pool->deques[id].executed++;
+            pool_finish( pool );
+            continue;
+        }
+
+        pthread_mutex_lock( &pool->idle_lock );
+        while ( pool->pending > 0 && pool->queued == 0 )
+            pthread_cond_wait( &pool->idle_cond, &pool->idle_lock );
+        int done = ( pool->pending == 0 );
+        pthread_mutex_unlock( &pool->idle_lock );
+
+        if ( done )
+            break;
+    }
+
+    return NULL;
+}
+
+/// Runs tasks to completion on a pool of nthreads work-stealing threads
+/// (the calling thread is worker 0); initial tasks are dealt round-robin
+/// @param tasks initial tasks
+/// @param ntasks number of initial tasks
+/// @param nthreads pool size (0 means one per online CPU)
+/// @param stats filled with pool statistics (may be NULL)
+static void pool_run( const sort_task_t *tasks, size_t ntasks,
+                      size_t nthreads, pool_stats_t *stats )
+{
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    simd_setup();
+
+    sort_pool_t pool;
+    pool.nworkers = nthreads;
+    pool.total = 0;
+    for ( size_t i = 0; i < ntasks; i++ )
+        pool.total += tasks[i].size;
+    pool.pending = 0;
+    pool.queued = 0;
+    pool.deques = calloc( nthreads, sizeof( worker_deque_t ) );
+    pthread_t *threads = malloc( nthreads * sizeof( pthread_t ) );
+    worker_args_t *wargs = malloc( nthreads * sizeof( worker_args_t ) );
+    if ( pool.deques == NULL || threads == NULL || wargs == NULL ) {
+        perror( "malloc failed in pool_run" );
+        exit( EXIT_FAILURE );
+    }
+    pthread_mutex_init( &pool.idle_lock, NULL );
+    pthread_cond_init( &pool.idle_cond, NULL );
+    for ( size_t i = 0; i < nthreads; i++ ) {
+        pthread_mutex_init( &pool.deques[i].lock, NULL );
+        wargs[i].pool = &pool;
+        wargs[i].id = i;
+    }
+
+    for ( size_t i = 0; i < ntasks; i++ )
+        if ( tasks[i].size > 1 )
+            pool_push( &pool, i % nthreads, tasks[i] );
+
+    /* the calling thread acts as worker 0 */
+    size_t started = 1;
+    for ( size_t i = 1; i < nthreads; i++ ) {
+        if ( pthread_create( &threads[i], NULL, pool_worker, &wargs[i] ) != 0 )
+            break;
+        started++;
+    }
+    pool_worker( &wargs[0] );
+    for ( size_t i = 1; i < started; i++ )
+        pthread_join( threads[i], NULL );
+
+    if ( stats != NULL ) {
+        stats->workers = started;
+        stats->tasks = stats->steals = 0;
+    }
+    for ( size_t i = 0; i < nthreads; i++ ) {
+        if ( stats != NULL ) {
+            stats->tasks  += pool.deques[i].executed;
+            stats->steals += pool.deques[i].steals;
+        }
+        free( pool.deques[i].tasks );
+        pthread_mutex_destroy( &pool.deques[i].lock );
+    }
+    pthread_cond_destroy( &pool.idle_cond );
+    pthread_mutex_destroy( &pool.idle_lock );
+    free( pool.deques );
+    free( threads );
+    free( wargs );
+}
+
+/// Sorts a copy of data on a fixed pool of work-stealing threads
+/// @param size number of elements
+/// @param data original array
+/// @param nthreads pool size (0 means one per online CPU)
+/// @param stats filled with pool statistics (may be NULL)
+/// @return newly allocated sorted array (caller must free)
+int *threaded_quicksort( size_t size, const int *data, size_t nthreads,
+                         pool_stats_t *stats )
+{
+    int *result = malloc( size * sizeof( int ) );
+    if ( size > 0 && result == NULL ) {
+        perror( "malloc failed in threaded_quicksort" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( size * sizeof( int ) );
+    memcpy( result, data, size * sizeof( int ) );
+
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    if ( adaptive_sort( size, result, nthreads, stats ) )
+        return result;
+
+    sort_task_t root = { result, size, depth_limit( size ), 0, NULL, 0 };
+    pool_run( &root, 1, nthreads, stats );
+
+    return result;
+}
+
+/*
+ * Fork-join helper for data-parallel phases
+ */
+
+/// Body of one data-parallel phase: called once per thread id
+typedef void ( *parallel_fn )( void *arg, size_t id, size_t nthreads );
+
+/// Argument handed to each parallel_run thread
+typedef struct {
+    parallel_fn fn;
+    void       *arg;
+    size_t      id;
+    size_t      nthreads;
+} parallel_args_t;
+
+static void *parallel_thread( void *arg )
+{
+    parallel_args_t *pa = (parallel_args_t *) arg;
+    pa->fn( pa->arg, pa->id, pa->nthreads );
+    return NULL;
+}
+
+/// Runs fn( arg, id, nthreads ) for id = 0 .. nthreads-1, one thread
+/// each (the caller runs id 0), and waits for all of them.  Every id is
+/// always run: if a thread cannot be created its id runs on the caller.
+static void parallel_run( size_t nthreads, parallel_fn fn, void *arg )
+{
+    pthread_t *threads = malloc( nthreads * sizeof( pthread_t ) );
+    parallel_args_t *pargs = malloc( nthreads * sizeof( parallel_args_t ) );
+    char *started = calloc( nthreads, 1 );
+    if ( threads == NULL || pargs == NULL || started == NULL ) {
+        perror( "malloc failed in parallel_run" );
+        exit( EXIT_FAILURE );
+    }
+
+    for ( size_t i = 0; i < nthreads; i++ ) {
+        pargs[i] = (parallel_args_t) { fn, arg, i, nthreads };
+        if ( i > 0 && pthread_create( &threads[i], NULL, parallel_thread,
+                                      &pargs[i] ) == 0 )
+            started[i] = 1;
+    }
+
+    for ( size_t i = 0; i < nthreads; i++ )
+        if ( !started[i] )
+            fn( arg, i, nthreads );
+    for ( size_t i = 1; i < nthreads; i++ )
+        if ( started[i] )
+            pthread_join( threads[i], NULL );
+
+    free( threads );
+    free( pargs );
+    free( started );
+}
+
+/*
+ * Adaptive sorting of presorted input
+ */
+
+/// Natural runs shorter than this count as unsorted input
+#define ADAPTIVE_MIN_RUN 64
+
+/// A stretch of the input: one natural run, or a gathered stretch of
+/// short runs that still has to be sorted
+typedef struct {
+    size_t start;
+    size_t len;
+    int    sorted;
+} adaptive_seg_t;
+
+/// Merge-stack entry of powersort
+typedef struct {
+    size_t   start;
+    size_t   len;
+    unsigned power;     ///< power of the boundary with the next entry
+} power_run_t;
+
+/// Reverses data[lo, hi)
+static void reverse_range( int *data, size_t lo, size_t hi )
+{
+    while ( lo + 1 < hi ) {
+        int t = data[lo];
+        data[lo++] = data[--hi];
+        data[hi] = t;
+    }
+}
+
+/// Splits data into segments: every ascending or strictly descending
+/// run of at least ADAPTIVE_MIN_RUN elements (descending ones are
+/// reversed) and the stretches of shorter runs between them.  The
+/// scan gives up as soon as short runs cover more than half the input.
+/// @return number of segments, or 0 if the input is not presorted
+static size_t find_runs( size_t size, int *data, adaptive_seg_t *segs )
+{
+    size_t nsegs = 0, unsorted = 0;
+
+    for ( size_t i = 0; i < size; ) {
+        size_t j = i + 1;
+        if ( j < size && data[j] < data[i] ) {
+            while ( j < size && data[j] < data[j - 1] )
+                j++;
+            if ( j - i >= ADAPTIVE_MIN_RUN )
+                reverse_range( data, i, j );
+        } else {
+            while ( j < size && data[j] >= data[j - 1] )
+                j++;
+        }
+
+        size_t len = j - i;
+        if ( len >= ADAPTIVE_MIN_RUN ) {
+            segs[nsegs++] = (adaptive_seg_t) { i, len, 1 };
+        } else {
+            unsorted += len;
+            if ( unsorted > size / 2 )
+                return 0;
+            if ( nsegs > 0 && !segs[nsegs - 1].sorted )
+                segs[nsegs - 1].len += len;
+            else
+                segs[nsegs++] = (adaptive_seg_t) { i, len, 0 };
+        }
+        i = j;
+    }
+    return nsegs;
+}
+
+/// First index of a[0, n) holding a value above v
+static size_t upper_bound( const int *a, size_t n, int v )
+{
+    size_t lo = 0;
+    while ( lo < n ) {
+        size_t mid = lo + ( n - lo ) / 2;
+        if ( a[mid] <= v )
+            lo = mid + 1;
+        else
+            n = mid;
+    }
+    return lo;
+}
+
+/// First index of a[0, n) holding a value not below v
+static size_t lower_bound( const int *a, size_t n, int v )
+{
+    size_t lo = 0;
+    while ( lo < n ) {
+        size_t mid = lo + ( n - lo ) / 2;
+        if ( a[mid] < v )
+            lo = mid + 1;
+        else
+            n = mid;
+    }
+    return lo;
+}
+
+/// Merges the sorted neighbours data[0, na) and data[na, na + nb).
+/// The head of the left run and the tail of the right run that are
+/// already in place are skipped, and only the shorter remaining side
+/// is copied to tmp (room for half the input is enough).
+static void merge_adjacent( int *data, size_t na, size_t nb, int *tmp )
+{
+    int *b = data + na;
+    size_t skip = upper_bound( data, na, b[0] );
+    data += skip;
+    na -= skip;
+    if ( na == 0 )
+        return;
+    nb = lower_bound( b, nb, data[na - 1] );
+    if ( nb == 0 )
+        return;
+
+    if ( na <= nb ) {
+        memcpy( tmp, data, na * sizeof( int ) );
+        size_t i = 0, j = 0, k = 0;
+        while ( i < na && j < nb )
+            data[k++] = b[j] < tmp[i] ? b[j++] : tmp[i++];
+        memcpy( data + k, tmp + i, ( na - i ) * sizeof( int ) );
+        STAT_ADD( comparisons, k );
+        STAT_ADD( moves, 2 * na + j );
+    } else {
+        memcpy( tmp, b, nb * sizeof( int ) );
+        size_t i = na, j = nb, k = na + nb;
+        while ( i > 0 && j > 0 )
+            data[--k] = data[i - 1] > tmp[j - 1] ? data[--i] : tmp[--j];
+        memcpy( data, tmp, j * sizeof( int ) );
+        STAT_ADD( comparisons, na + nb - k );
+        STAT_ADD( moves, 2 * nb + ( na - i ) );
+    }
+}
+
+/// Powersort node power of the boundary between the run [s1, s1 + n1)
+/// and the n2 elements after it: the depth at which the two run
+/// midpoints, as fractions of size, first fall in different halves
+static unsigned node_power( size_t size, size_t s1, size_t n1, size_t n2 )
+{
+    size_t a = 2 * s1 + n1;         // twice the midpoints
+    size_t b = a + n1 + n2;
+    unsigned power = 0;
+
+    for ( ;; ) {
+        power++;
+        if ( a >= size ) {
+            a -= size;
+            b -= size;
+        } else if ( b >= size ) {
+            break;
+        }
+        a <<= 1;
+        b <<= 1;
+    }
+    return power;
+}
+
+/// Merges the sorted segments with the powersort policy: a run on the
+/// stack is merged once a boundary of lower power arrives, which keeps
+/// merges balanced (O(n log r) for r runs) and the stack O(log n) deep
+static void powersort_merge( size_t size, int *data,
+                             const adaptive_seg_t *segs, size_t nsegs,
+                             int *tmp )
+{
+    power_run_t stack[ sizeof( size_t ) * CHAR_BIT + 1 ];
+    size_t top = 0;
+
+    stack[top++] = (power_run_t) { segs[0].start, segs[0].len, 0 };
+    for ( size_t k = 1; k < nsegs; k++ ) {
+        unsigned p = node_power( size, stack[top - 1].start,
+                                 stack[top - 1].len, segs[k].len );
+        while ( top > 1 && stack[top - 2].power > p ) {
+            merge_adjacent( data + stack[top - 2].start, stack[top - 2].len,
+                            stack[top - 1].len, tmp );
+            stack[top - 2].len += stack[top - 1].len;
+            top--;
+        }
+        stack[top - 1].power = p;
+        stack[top++] = (power_run_t) { segs[k].start, segs[k].len, 0 };
+    }
+
+    for ( ; top > 1; top-- ) {
+        merge_adjacent( data + stack[top - 2].start, stack[top - 2].len,
+                        stack[top - 1].len, tmp );
+        stack[top - 2].len += stack[top - 1].len;
+    }
+}
+
+/// Sorts presorted input by its natural runs: the stretches between
+/// long runs are sorted (on the pool when nthreads > 1) and everything
+/// is merged by powersort.  Input that is not mostly long runs is left
+/// for quicksort (descending runs may have been reversed).
+/// @param size number of elements
+/// @param data array to sort
+/// @param nthreads 1 for the sequential sort, else pool size
+/// @param stats filled with pool statistics (may be NULL)
+/// @return 1 if data was sorted, 0 if it is not presorted
+static int adaptive_sort( size_t size, int *data, size_t nthreads,
+                          pool_stats_t *stats )
+{
+    if ( !adaptive_runs || size < 2 * ADAPTIVE_MIN_RUN )
+        return 0;
+
+    adaptive_seg_t *segs = malloc( ( size / ADAPTIVE_MIN_RUN * 2 + 2 ) *
+                                   sizeof( adaptive_seg_t ) );
+    if ( segs == NULL ) {
+        perror( "malloc failed in adaptive_sort" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( ( size / ADAPTIVE_MIN_RUN * 2 + 2 ) *
+                sizeof( adaptive_seg_t ) );
+    size_t nsegs = find_runs( size, data, segs );
+    if ( nsegs == 0 ) {
+        free( segs );
+        return 0;
+    }
+
+    if ( nthreads == 1 ) {
+        unsigned long sorted = 0;
+        for ( size_t k = 0; k < nsegs; k++ )
+            if ( !segs[k].sorted ) {
+                sort_in_place( segs[k].len, data + segs[k].start );
+                sorted++;
+            }
+        if ( stats != NULL )
+            *stats = (pool_stats_t) { 1, sorted, 0 };
+    } else {
+        sort_task_t *tasks = malloc( nsegs * sizeof( sort_task_t ) );
+        if ( tasks == NULL ) {
+            perror( "malloc failed in adaptive_sort" );
+            exit( EXIT_FAILURE );
+        }
+        size_t ntasks = 0;
+        for ( size_t k = 0; k < nsegs; k++ )
+            if ( !segs[k].sorted )
+                tasks[ntasks++] = (sort_task_t) {
+                    data + segs[k].start, segs[k].len,
+                    depth_limit( segs[k].len ), 0, NULL, 0 };
+        pool_run( tasks, ntasks, nthreads, stats );
+        free( tasks );
+    }
+
+    if ( nsegs > 1 ) {
+        int *tmp = malloc( ( size / 2 + 1 ) * sizeof( int ) );
+        if ( tmp == NULL ) {
+            perror( "malloc failed in adaptive_sort" );
+            exit( EXIT_FAILURE );
+        }
+        STAT_ALLOC( ( size / 2 + 1 ) * sizeof( int ) );
+        STAT_TIMER( t_merge );
+        powersort_merge( size, data, segs, nsegs, tmp );
+        STAT_ELAPSED( t_merge, merge_time );
+        free( tmp );
+    }
+    free( segs );
+    return 1;
+}
+
+/*
+ * Parallel LSD radix sort
+ */
+
+/// Bits per digit; 8 keeps each thread's histogram (1 KB) in L1
+#define RADIX_BITS    8
+#define RADIX_BUCKETS ( 1 << RADIX_BITS )
+#define RADIX_PASSES  ( 32 / RADIX_BITS )
+
+/// Elements staged per bucket before a flush (one 64-byte cache line)
+#define RADIX_WC_SLOTS 16
+
+/// Inputs smaller than this are radix sorted on one thread
+#define RADIX_PARALLEL_MIN 65536
+
+/// Shared state of one radix sort run
+typedef struct {
+    size_t             nthreads;
+    size_t             size;
+    int               *buf[2];      ///< ping-pong buffers
+    size_t            *pay[2];      ///< payload moved with the keys, or NULL
+    size_t           (*hist)[RADIX_BUCKETS];  ///< per-thread counts
+    int                skip;        ///< current pass leaves order as is
+    int                final;       ///< buffer holding the result
+    pthread_barrier_t  barrier;
+} radix_job_t;
+
+/// Argument handed to each radix thread
+typedef struct {
+    radix_job_t *job;
+    size_t       id;
+} radix_args_t;
+
+/// Digit of x for the given pass; the top digit has its sign bit
+/// flipped so negative numbers order before positive ones
+static inline unsigned radix_digit( int x, int pass )
+{
+    unsigned d = ( (unsigned) x >> ( pass * RADIX_BITS ) ) &
+                 ( RADIX_BUCKETS - 1 );
+    if ( pass == RADIX_PASSES - 1 )
+        d ^= 1u << ( RADIX_BITS - 1 );
+    return d;
+}
+
+/// Scatters src[lo, hi) into dst by digit, staging elements in
+/// cache-line sized per-bucket buffers so each bucket is written a
+/// full line at a time
+/// @param offset next write index per bucket (advanced)
+static void radix_scatter( const int *src, int *dst, size_t lo, size_t hi,
+                           int pass, size_t *offset,
+                           int ( *wc )[RADIX_WC_SLOTS], unsigned char *fill )
+{
+    memset( fill, 0, RADIX_BUCKETS );
+
+    for ( size_t i = lo; i < hi; i++ ) {
+        int x = src[i];
+        unsigned d = radix_digit( x, pass );
+        wc[d][ fill[d]++ ] = x;
+        if ( fill[d] == RADIX_WC_SLOTS ) {
+            memcpy( dst + offset[d], wc[d], sizeof( wc[d] ) );
+            offset[d] += RADIX_WC_SLOTS;
+            fill[d] = 0;
+        }
+    }
+
+    for ( unsigned d = 0; d < RADIX_BUCKETS; d++ ) {
+        memcpy( dst + offset[d], wc[d], fill[d] * sizeof( int ) );
+        offset[d] += fill[d];
+    }
+}
+
+/// radix_scatter for keys with a payload: both go through their own
+/// write-combining buffers so a payload always lands beside its key
+static void radix_scatter_pairs( const int *src, const size_t *psrc,
+                                 int *dst, size_t *pdst, size_t lo,
+                                 size_t hi, int pass, size_t *offset,
+                                 int ( *wc )[RADIX_WC_SLOTS],
+                                 size_t ( *wcp )[RADIX_WC_SLOTS],
+                                 unsigned char *fill )
+{
+    memset( fill, 0, RADIX_BUCKETS );
+
+    for ( size_t i = lo; i < hi; i++ ) {
+        int x = src[i];
+        unsigned d = radix_digit( x, pass );
+        wcp[d][ fill[d] ] = psrc[i];
+        wc[d][ fill[d]++ ] = x;
+        if ( fill[d] == RADIX_WC_SLOTS ) {
+            memcpy( dst + offset[d], wc[d], sizeof( wc[d] ) );
+            memcpy( pdst + offset[d], wcp[d], sizeof( wcp[d] ) );
+            offset[d] += RADIX_WC_SLOTS;
+            fill[d] = 0;
+        }
+    }
+
+    for ( unsigned d = 0; d < RADIX_BUCKETS; d++ ) {
+        memcpy( dst + offset[d], wc[d], fill[d] * sizeof( int ) );
+        memcpy( pdst + offset[d], wcp[d], fill[d] * sizeof( size_t ) );
+        offset[d] += fill[d];
+    }
+}
+
+/// Radix thread body: histogram, prefix sum and scatter for each pass
+static void *radix_worker( void *arg )
+{
+    radix_args_t *ra = (radix_args_t *) arg;
+    radix_job_t *job = ra->job;
+    size_t id = ra->id;
+    size_t lo = job->size * id / job->nthreads;
+    size_t hi = job->size * ( id + 1 ) / job->nthreads;
+    size_t *hist = job->hist[id];
+    int cur = 0;
+
+    int ( *wc )[RADIX_WC_SLOTS] = malloc( RADIX_BUCKETS * sizeof( *wc ) );
+    size_t ( *wcp )[RADIX_WC_SLOTS] = NULL;
+    unsigned char fill[RADIX_BUCKETS];
+    if ( job->pay[0] != NULL )
+        wcp = malloc( RADIX_BUCKETS * sizeof( *wcp ) );
+    if ( wc == NULL || ( job->pay[0] != NULL && wcp == NULL ) ) {
+        perror( "malloc failed in radix_worker" );
+        exit( EXIT_FAILURE );
+    }
+
+    STAT_TIMER( t_radix );
+    for ( int pass = 0; pass < RADIX_PASSES; pass++ ) {
+        const int *src = job->buf[cur];
+
+        memset( hist, 0, RADIX_BUCKETS * sizeof( size_t ) );
+        for ( size_t i = lo; i < hi; i++ )
+            hist[ radix_digit( src[i], pass ) ]++;
+
+        pthread_barrier_wait( &job->barrier );
+
+        /* thread 0 turns the counts into starting offsets, ordered by
+         * (digit, thread), and skips passes with a single live digit */
+        if ( id == 0 ) {
+            job->skip = 0;
+            size_t running = 0;
+            for ( unsigned d = 0; d < RADIX_BUCKETS; d++ ) {
+                size_t total = 0;
+                for ( size_t t = 0; t < job->nthreads; t++ ) {
+                    size_t c = job->hist[t][d];
+                    job->hist[t][d] = running;
+                    running += c;
+                    total += c;
+                }
+                if ( total == job->size )
+                    job->skip = 1;
+            }
+        }
+
+        pthread_barrier_wait( &job->barrier );
+
+        if ( !job->skip ) {
+            if ( wcp != NULL )
+                radix_scatter_pairs( src, job->pay[cur], job->buf[1 - cur],
+                                     job->pay[1 - cur], lo, hi, pass,
+                                     hist, wc, wcp, fill );
+            else
+                radix_scatter( src, job->buf[1 - cur], lo, hi, pass,
+                               hist, wc, fill );
+            STAT_ADD( moves, hi - lo );
+            cur = 1 - cur;
+        }
+
+        pthread_barrier_wait( &job->barrier );
+    }
+    STAT_ELAPSED( t_radix, partition_time );
+
+    if ( id == 0 )
+        job->final = cur;
+    free( wc );
+    free( wcp );
+    return NULL;
+}
+
+/// Runs radix_worker on job->nthreads threads (the caller is thread 0)
+/// once the buffers are set up
+static void radix_run( radix_job_t *job )
+{
+    size_t nthreads = job->nthreads;
+    job->hist = malloc( nthreads * sizeof( *job->hist ) );
+    pthread_t *threads = malloc( nthreads * sizeof( pthread_t ) );
+    radix_args_t *rargs = malloc( nthreads * sizeof( radix_args_t ) );
+    if ( job->hist == NULL || threads == NULL || rargs == NULL ) {
+        perror( "malloc failed in radix_run" );
+        exit( EXIT_FAILURE );
+    }
+
+    pthread_barrier_init( &job->barrier, NULL, (unsigned) nthreads );
+    for ( size_t i = 0; i < nthreads; i++ ) {
+        rargs[i].job = job;
+        rargs[i].id = i;
+    }
+
+    /* every thread must reach each barrier, so a failed create is fatal */
+    for ( size_t i = 1; i < nthreads; i++ ) {
+        if ( pthread_create( &threads[i], NULL, radix_worker,
+                             &rargs[i] ) != 0 ) {
+            perror( "pthread_create in radix_run" );
+            exit( EXIT_FAILURE );
+        }
+    }
+    radix_worker( &rargs[0] );
+    for ( size_t i = 1; i < nthreads; i++ )
+        pthread_join( threads[i], NULL );
+
+    pthread_barrier_destroy( &job->barrier );
+    free( job->hist );
+    free( threads );
+    free( rargs );
+}
+
+/// Sorts a copy of data with an LSD radix sort on nthreads threads
+/// @param size number of elements
+/// @param data original array
+/// @param nthreads number of threads (0 means one per online CPU)
+/// @return newly allocated sorted array (caller must free)
+int *radix_sort( size_t size, const int *data, size_t nthreads )
+{
+    radix_job_t job;
+
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    if ( size < RADIX_PARALLEL_MIN )
+        nthreads = 1;
+
+    job.nthreads = nthreads;
+    job.size = size;
+    job.buf[0] = malloc( size * sizeof( int ) );
+    job.buf[1] = malloc( size * sizeof( int ) );
+    job.pay[0] = job.pay[1] = NULL;
+    if ( size > 0 && ( job.buf[0] == NULL || job.buf[1] == NULL ) ) {
+        perror( "malloc failed in radix_sort" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( 2 * size * sizeof( int ) );
+    memcpy( job.buf[0], data, size * sizeof( int ) );
+
+    radix_run( &job );
+
+    free( job.buf[ 1 - job.final ] );
+    return job.buf[ job.final ];
+}
+
+/// Sorts keys in place with LSD radix sort, moving payload[i] with
+/// keys[i] (structure of arrays).  Stable: equal keys keep their order.
+/// @param size number of elements
+/// @param keys keys to sort
+/// @param payload values carried with the keys
+/// @param nthreads number of threads (0 means one per online CPU)
+void radix_sort_pairs( size_t size, int *keys, size_t *payload,
+                       size_t nthreads )
+{
+    radix_job_t job;
+
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    if ( size < RADIX_PARALLEL_MIN )
+        nthreads = 1;
+
+    job.nthreads = nthreads;
+    job.size = size;
+    job.buf[0] = keys;
+    job.buf[1] = malloc( ( size > 0 ? size : 1 ) * sizeof( int ) );
+    job.pay[0] = payload;
+    job.pay[1] = malloc( ( size > 0 ? size : 1 ) * sizeof( size_t ) );
+    if ( job.buf[1] == NULL || job.pay[1] == NULL ) {
+        perror( "malloc failed in radix_sort_pairs" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( size * ( sizeof( int ) + sizeof( size_t ) ) );
+
+    radix_run( &job );
+
+    if ( job.final == 1 ) {
+        memcpy( keys, job.buf[1], size * sizeof( int ) );
+        memcpy( payload, job.pay[1], size * sizeof( size_t ) );
+    }
+    free( job.buf[1] );
+    free( job.pay[1] );
+}
+
+/*
+ * Parallel samplesort
+ */
+
+/// Buckets per thread; more than one lets the pool even out buckets
+/// of different sizes
+#define SAMPLE_BUCKETS_PER_THREAD 4
+
+/// Samples drawn per bucket when choosing splitters
+#define SAMPLE_OVERSAMPLING 32
+
+/// Inputs smaller than this go straight to the quicksort pool
+#define SAMPLESORT_MIN 65536
+
+/// Shared state of one samplesort run
+typedef struct {
+    size_t      size;
+    const int  *src;
+    int        *dst;
+    uint16_t   *bucket_of;      ///< bucket index of every element
+    int        *splitters;      ///< nbuckets - 1 sorted splitters
+    size_t      nbuckets;       ///< power of two
+    size_t     *offsets;        ///< nthreads x nbuckets counts/offsets
+} sample_job_t;
+
+/// Bucket of x: the number of splitters <= x, found by a branch-free
+/// binary search (nbuckets is a power of two)
+static inline size_t sample_bucket( const int *splitters, size_t nbuckets,
+                                    int x )
+{
+    size_t b = 0;
+
+    for ( size_t step = nbuckets / 2; step > 0; step /= 2 )
+        b += ( splitters[b + step - 1] <= x ) ? step : 0;
+    return b;
+}
+
+/// Phase 1: classify this thread's chunk and count per bucket
+static void sample_classify( void *arg, size_t id, size_t nthreads )
+{
+    sample_job_t *job = (sample_job_t *) arg;
+    size_t lo = job->size * id / nthreads;
+    size_t hi = job->size * ( id + 1 ) / nthreads;
+    size_t *count = job->offsets + id * job->nbuckets;
+
+    STAT_TIMER( t_classify );
+    memset( count, 0, job->nbuckets * sizeof( size_t ) );
+    for ( size_t i = lo; i < hi; i++ ) {
+        size_t b = sample_bucket( job->splitters, job->nbuckets,
+                                  job->src[i] );
+        job->bucket_of[i] = (uint16_t) b;
+        count[b]++;
+    }
+    STAT_ADD( comparisons,
+              ( hi - lo ) * (size_t) __builtin_ctzll( job->nbuckets ) );
+    STAT_ELAPSED( t_classify, partition_time );
+}
+
+/// Phase 2: move this thread's chunk to its buckets' output ranges
+static void sample_scatter( void *arg, size_t id, size_t nthreads )
+{
+    sample_job_t *job = (sample_job_t *) arg;
+    size_t lo = job->size * id / nthreads;
+    size_t hi = job->size * ( id + 1 ) / nthreads;
+    size_t *offset = job->offsets + id * job->nbuckets;
+
+    STAT_TIMER( t_scatter );
+    for ( size_t i = lo; i < hi; i++ )
+        job->dst[ offset[ job->bucket_of[i] ]++ ] = job->src[i];
+    STAT_ADD( moves, hi - lo );
+    STAT_ELAPSED( t_scatter, partition_time );
+}
+
+/// Copies data into buckets of increasing value ranges on nthreads
+/// threads: splitters from an oversampled random sample, parallel
+/// classification, then a parallel scatter.  Equal values always share
+/// a bucket.
+/// @param nbuckets_out set to the number of buckets
+/// @return one unsorted task per bucket, in value order, covering a
+///         newly allocated copy of data that starts at tasks[0].data
+///         (caller must free both)
+static sort_task_t *sample_distribute( size_t size, const int *data,
+                                       size_t nthreads,
+                                       size_t *nbuckets_out )
+{
+    size_t nbuckets = 2;
+    while ( nbuckets < nthreads * SAMPLE_BUCKETS_PER_THREAD &&
+            nbuckets < ( 1 << 16 ) )
+        nbuckets *= 2;
+
+    sample_job_t job;
+    size_t nsamples = nbuckets * SAMPLE_OVERSAMPLING;
+    int *sample = malloc( nsamples * sizeof( int ) );
+    job.size = size;
+    job.src = data;
+    job.dst = malloc( size * sizeof( int ) );
+    job.bucket_of = malloc( size * sizeof( uint16_t ) );
+    job.splitters = malloc( nbuckets * sizeof( int ) );
+    job.nbuckets = nbuckets;
+    job.offsets = malloc( nthreads * nbuckets * sizeof( size_t ) );
+    sort_task_t *tasks = malloc( nbuckets * sizeof( sort_task_t ) );
+    if ( sample == NULL || job.dst == NULL || job.bucket_of == NULL ||
+         job.splitters == NULL || job.offsets == NULL || tasks == NULL ) {
+        perror( "malloc failed in samplesort" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( nsamples * sizeof( int ) +
+                size * ( sizeof( int ) + sizeof( uint16_t ) ) +
+                nbuckets * ( sizeof( int ) + nthreads * sizeof( size_t ) +
+                             sizeof( sort_task_t ) ) );
+
+    /* splitters: every SAMPLE_OVERSAMPLING-th element of a sorted
+     * random sample */
+    for ( size_t i = 0; i < nsamples; i++ )
+        sample[i] = data[ mix64( pivot_seed + i ) % size ];
+    sort_in_place( nsamples, sample );
+    for ( size_t b = 1; b < nbuckets; b++ )
+        job.splitters[b - 1] = sample[ b * SAMPLE_OVERSAMPLING ];
+    free( sample );
+
+    parallel_run( nthreads, sample_classify, &job );
+
+    /* counts -> output offsets, bucket-major so each bucket is one
+     * contiguous range and each thread's share of it is in order */
+    size_t running = 0;
+    for ( size_t b = 0; b < nbuckets; b++ ) {
+        tasks[b].data = job.dst + running;
+        for ( size_t t = 0; t < nthreads; t++ ) {
+            size_t c = job.offsets[t * nbuckets + b];
+            job.offsets[t * nbuckets + b] = running;
+            running += c;
+        }
+        tasks[b].size = (size_t) ( job.dst + running - tasks[b].data );
+        tasks[b].depth_left = depth_limit( tasks[b].size );
+        tasks[b].level = 0;
+        tasks[b].join = NULL;
+        tasks[b].piece = 0;
+    }
+
+    parallel_run( nthreads, sample_scatter, &job );
+
+    free( job.bucket_of );
+    free( job.splitters );
+    free( job.offsets );
+
+    *nbuckets_out = nbuckets;
+    return tasks;
+}
+
+/// Sorts a copy of data with a parallel samplesort: the input is
+/// distributed into buckets (sample_distribute), then every bucket is
+/// sorted as a task on the work-stealing pool
+/// @param size number of elements
+/// @param data original array
+/// @param nthreads number of threads (0 means one per online CPU)
+/// @param stats filled with pool statistics (may be NULL)
+/// @return newly allocated sorted array (caller must free)
+int *samplesort( size_t size, const int *data, size_t nthreads,
+                 pool_stats_t *stats )
+{
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    if ( size < SAMPLESORT_MIN )
+        return threaded_quicksort( size, data, nthreads, stats );
+
+    size_t nbuckets;
+    sort_task_t *tasks = sample_distribute( size, data, nthreads,
+                                            &nbuckets );
+    int *sorted = tasks[0].data;
+
+    pool_run( tasks, nbuckets, nthreads, stats );
+
+    free( tasks );
+    return sorted;
+}
+
+/*
+ * Stable parallel merge sort
+ */
+
+/// Length of the runs insertion sorted before merging starts
+#define MERGE_RUN 32
+
+/// Inputs smaller than this are merge sorted on one thread
+#define MERGE_PARALLEL_MIN 65536
+
+/// Shared state of one merge sort: a level merges pairs of sorted runs
+/// of width elements from src into dst
+typedef struct {
+    size_t  size;
+    size_t  width;
+    int    *src, *dst;
+    size_t *psrc, *pdst;    ///< payloads moved with the keys, or NULL
+} merge_job_t;
+
+/// Stable insertion sort of keys, moving pay (if not NULL) alongside
+static void merge_insertion( size_t size, int *keys, size_t *pay )
+{
+    for ( size_t i = 1; i < size; i++ ) {
+        int k = keys[i];
+        size_t p = pay != NULL ? pay[i] : 0;
+        size_t j = i;
+        while ( j > 0 && keys[j - 1] > k ) {
+            keys[j] = keys[j - 1];
+            if ( pay != NULL )
+                pay[j] = pay[j - 1];
+            j--;
+        }
+        keys[j] = k;
+        if ( pay != NULL )
+            pay[j] = p;
+        STAT_ADD( comparisons, i - j + ( j > 0 ) );
+        STAT_ADD( moves, i - j + 1 );
+    }
+}
+
+/// Insertion sorts the MERGE_RUN-element runs of this thread's share
+static void merge_runs_worker( void *arg, size_t id, size_t nthreads )
+{
+    merge_job_t *job = (merge_job_t *) arg;
+    size_t nruns = ( job->size + MERGE_RUN - 1 ) / MERGE_RUN;
+
+    STAT_TIMER( t_runs );
+    for ( size_t r = nruns * id / nthreads;
+          r < nruns * ( id + 1 ) / nthreads; r++ ) {
+        size_t lo = r * MERGE_RUN;
+        size_t n = job->size - lo < MERGE_RUN ? job->size - lo : MERGE_RUN;
+        merge_insertion( n, job->src + lo,
+                         job->psrc != NULL ? job->psrc + lo : NULL );
+    }
+    STAT_ELAPSED( t_runs, leaf_time );
+}
+
+/// Merge path: the number of elements of a among the first d outputs
+/// of the stable merge of a and b (ties go to a)
+static size_t merge_path( const int *a, size_t na, const int *b, size_t nb,
+                          size_t d )
+{
+    size_t lo = d > nb ? d - nb : 0;
+    size_t hi = d < na ? d : na;
+
+    while ( lo < hi ) {
+        size_t mid = lo + ( hi - lo ) / 2;
+        if ( a[mid] <= b[d - mid - 1] )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/// Writes outputs [d0, d1) of the merge of the run pair at start
+static void merge_segment( const merge_job_t *job, size_t start,
+                           size_t d0, size_t d1 )
+{
+    size_t rest = job->size - start;
+    size_t na = rest < job->width ? rest : job->width;
+    size_t nb = rest - na < job->width ? rest - na : job->width;
+    const int *a = job->src + start, *b = a + na;
+
+    size_t i = merge_path( a, na, b, nb, d0 );
+    size_t j = d0 - i;
+    int *out = job->dst + start + d0;
+    size_t count = d1 - d0;
+
+    STAT_ADD( moves, d1 - d0 );
+
+    if ( job->psrc == NULL ) {
+        /* branch-free while both runs have elements: the comparison
+         * only selects a value and advances one index */
+        for ( ; count > 0 && i < na && j < nb; count-- ) {
+            int x = a[i], y = b[j];
+            int take_a = x <= y;
+            *out++ = take_a ? x : y;
+            i += (size_t) take_a;
+            j += (size_t) !take_a;
+        }
+        STAT_ADD( comparisons, d1 - d0 - count );
+        if ( count > 0 && i < na )
+            memcpy( out, a + i, count * sizeof( int ) );
+        else if ( count > 0 )
+            memcpy( out, b + j, count * sizeof( int ) );
+        return;
+    }
+
+    const size_t *pa = job->psrc + start, *pb = pa + na;
+    size_t *pout = job->pdst + start + d0;
+    STAT_ADD( comparisons, count );
+    for ( ; count > 0; count-- ) {
+        if ( j >= nb || ( i < na && a[i] <= b[j] ) ) {
+            *pout++ = pa[i];
+            *out++ = a[i++];
+        } else {
+            *pout++ = pb[j];
+            *out++ = b[j++];
+        }
+    }
+}
+
+/// Merges one level.  The output is cut into nthreads equal slices
+/// regardless of run boundaries; merge path finds where each slice
+/// starts inside its run pairs, so every thread does the same amount
+/// of work even when only one pair is left.
+static void merge_level_worker( void *arg, size_t id, size_t nthreads )
+{
+    merge_job_t *job = (merge_job_t *) arg;
+    size_t lo = job->size * id / nthreads;
+    size_t hi = job->size * ( id + 1 ) / nthreads;
+    size_t pair = 2 * job->width;
+
+    STAT_TIMER( t_merge );
+    for ( size_t start = lo - lo % pair; start < hi; start += pair ) {
+        size_t end = start + pair < job->size ? start + pair : job->size;
+        size_t d0 = ( lo > start ? lo : start ) - start;
+        size_t d1 = ( hi < end ? hi : end ) - start;
+        merge_segment( job, start, d0, d1 );
+    }
+    STAT_ELAPSED( t_merge, merge_time );
+}
+
+/// Bottom-up merge sort of keys (and payload) in buf[0] using buf[1]
+/// as the single scratch buffer
+/// @return index of the buffer holding the result
+static int merge_sort_buffers( size_t size, int *buf[2], size_t *pay[2],
+                               size_t nthreads )
+{
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    if ( size < MERGE_PARALLEL_MIN )
+        nthreads = 1;
+
+    merge_job_t job = { size, MERGE_RUN, buf[0], buf[1], pay[0], pay[1] };
+    parallel_run( nthreads, merge_runs_worker, &job );
+
+    int cur = 0;
+    for ( ; job.width < size; job.width *= 2 ) {
+        job.src = buf[cur];
+        job.dst = buf[1 - cur];
+        job.psrc = pay[cur];
+        job.pdst = pay[1 - cur];
+        parallel_run( nthreads, merge_level_worker, &job );
+        cur = 1 - cur;
+    }
+    return cur;
+}
+
+/// Sorts a copy of data with a stable bottom-up merge sort on nthreads
+/// threads: runs of MERGE_RUN are insertion sorted, then each level of
+/// merges is split evenly across the threads by merge path
+/// @param size number of elements
+/// @param data original array
+/// @param nthreads number of threads (0 means one per online CPU)
+/// @return newly allocated sorted array (caller must free)
+int *merge_sort( size_t size, const int *data, size_t nthreads )
+{
+    int *buf[2];
+    size_t *pay[2] = { NULL, NULL };
+    buf[0] = malloc( ( size > 0 ? size : 1 ) * sizeof( int ) );
+    buf[1] = malloc( ( size > 0 ? size : 1 ) * sizeof( int ) );
+    if ( buf[0] == NULL || buf[1] == NULL ) {
+        perror( "malloc failed in merge_sort" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( 2 * size * sizeof( int ) );
+    memcpy( buf[0], data, size * sizeof( int ) );
+
+    int final = merge_sort_buffers( size, buf, pay, nthreads );
+    free( buf[1 - final] );
+    return buf[final];
+}
+
+/// Stable merge sort of keys in place, moving payload[i] with keys[i]
+/// @param size number of elements
+/// @param keys keys to sort
+/// @param payload values carried with the keys
+/// @param nthreads number of threads (0 means one per online CPU)
+void merge_sort_pairs( size_t size, int *keys, size_t *payload,
+                       size_t nthreads )
+{
+    int *buf[2] = { keys, malloc( ( size > 0 ? size : 1 ) * sizeof( int ) ) };
+    size_t *pay[2] = { payload,
+                       malloc( ( size > 0 ? size : 1 ) * sizeof( size_t ) ) };
+    if ( buf[1] == NULL || pay[1] == NULL ) {
+        perror( "malloc failed in merge_sort_pairs" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( size * ( sizeof( int ) + sizeof( size_t ) ) );
+
+    if ( merge_sort_buffers( size, buf, pay, nthreads ) == 1 ) {
+        memcpy( keys, buf[1], size * sizeof( int ) );
+        memcpy( payload, pay[1], size * sizeof( size_t ) );
+    }
+    free( buf[1] );
+    free( pay[1] );
+}
+
+/*
+ * Selection: quickselect, percentiles and top-k
+ */
+
+/// Top-k requests with k below size / TOP_K_HEAP_RATIO scan the input
+/// once with a k-element heap instead of partitioning a full copy
+#define TOP_K_HEAP_RATIO 64
+
+/// Three-way partition of data[0, size), split over up to nthreads
+/// threads when the range is large enough to pay for it
+static void select_partition( size_t nthreads, size_t size, int *data,
+                              size_t *lt, size_t *gt )
+{
+    size_t helpers = size / PARALLEL_PARTITION_CHUNK;
+    if ( helpers > nthreads )
+        helpers = nthreads;
+
+    STAT_TIMER( t_part );
+    if ( size >= PARALLEL_PARTITION_MIN && helpers > 1 &&
+         partition_kernel != KERNEL_DUTCH )
+        parallel_partition3( NULL, 0, helpers, choose_pivot( size, data ),
+                             size, data, lt, gt );
+    else
+        partition_range( choose_pivot( size, data ), size, data, lt, gt );
+    STAT_ELAPSED( t_part, partition_time );
+}
+
+/// Introselect: rearranges data so data[k] holds the value of rank k,
+/// with nothing larger before it and nothing smaller after it.  Only
+/// the side holding k is partitioned further; a range that uses up
+/// the depth budget is heapsorted.
+/// @param size number of elements
+/// @param data array to rearrange
+/// @param k rank to place (0-based, below size)
+/// @param nthreads threads for partitioning large ranges
+static void select_in_place( size_t size, int *data, size_t k,
+                             size_t nthreads )
+{
+    unsigned depth_left = depth_limit( size );
+    STAT_LEVEL( level );
+
+    while ( size > SMALL_SORT_CUTOFF ) {
+        if ( depth_left == 0 ) {
+            heap_sort( size, data );
+            return;
+        }
+        depth_left--;
+
+        size_t lt, gt;
+        select_partition( nthreads, size, data, &lt, &gt );
+        STAT_PARTITION( level++, size, lt, gt );
+
+        if ( k < lt ) {
+            size = lt;
+        } else if ( k < gt ) {
+            return;             // k landed among the copies of the pivot
+        } else {
+            data += gt;
+            size -= gt;
+            k -= gt;
+        }
+    }
+
+    STAT_TIMER( t_leaf );
+    small_sort( size, data );
+    STAT_ELAPSED( t_leaf, leaf_time );
+}
+
+/// Places several ranks at once.  Every partition is shared by all the
+/// ranks inside the range, and a side is only partitioned further when
+/// some rank falls in it.
+/// @param size number of elements
+/// @param data array to rearrange; data[0] has rank base
+/// @param base rank of data[0] in the whole array
+/// @param ranks ascending ranks to place, all in [base, base + size)
+/// @param nranks number of ranks
+/// @param depth_left remaining partitioning levels before heapsort
+/// @param nthreads threads for partitioning large ranges
+static void multiselect( size_t size, int *data, size_t base,
+                         const size_t *ranks, size_t nranks,
+                         unsigned depth_left, size_t nthreads )
+{
+    STAT_LEVEL( level );
+
+    while ( nranks > 0 ) {
+        if ( nranks == 1 ) {
+            STAT_SET_LEVEL( level );
+            select_in_place( size, data, ranks[0] - base, nthreads );
+            return;
+        }
+        if ( size <= SMALL_SORT_CUTOFF ) {
+            STAT_TIMER( t_leaf );
+            small_sort( size, data );
+            STAT_ELAPSED( t_leaf, leaf_time );
+            return;
+        }
+        if ( depth_left == 0 ) {
+            heap_sort( size, data );
+            return;
+        }
+        depth_left--;
+
+        size_t lt, gt;
+        select_partition( nthreads, size, data, &lt, &gt );
+        STAT_PARTITION( level++, size, lt, gt );
+
+        /* ranks below lt go left, ranks in [lt, gt) are already placed */
+        size_t nleft = 0;
+        while ( nleft < nranks && ranks[nleft] - base < lt )
+            nleft++;
+        size_t right = nleft;
+        while ( right < nranks && ranks[right] - base < gt )
+            right++;
+
+        /* recurse on the side with fewer ranks and loop on the other */
+        STAT_SET_LEVEL( level );
+        if ( nleft < nranks - right ) {
+            multiselect( lt, data, base, ranks, nleft, depth_left,
+                         nthreads );
+            data += gt;
+            base += gt;
+            size -= gt;
+            ranks += right;
+            nranks -= right;
+        } else {
+            multiselect( size - gt, data + gt, base + gt, ranks + right,
+                         nranks - right, depth_left, nthreads );
+            size = lt;
+            nranks = nleft;
+        }
+    }
+}
+
+/// Copies data for the selection entry points
+static int *select_copy( size_t size, const int *data )
+{
+    int *copy = malloc( ( size > 0 ? size : 1 ) * sizeof( int ) );
+    if ( copy == NULL ) {
+        perror( "malloc failed in select_copy" );
+        exit( EXIT_FAILURE );
+    }
+    STAT_ALLOC( size * sizeof( int ) );
+    memcpy( copy, data, size * sizeof( int ) );
+    simd_setup();
+    STAT_SET_LEVEL( 0 );
+    return copy;
+}
+
+/// Returns the value of rank k (0-based) of data without sorting it;
+/// large inputs are partitioned on one thread per online CPU
+/// @param size number of elements
+/// @param data original array (not modified)
+/// @param k rank to find (below size)
+/// @return the k-th smallest value
+int quickselect( size_t size, const int *data, size_t k )
+{
+    int *copy = select_copy( size, data );
+    select_in_place( size, copy, k, online_cpus() );
+    int value = copy[k];
+    free( copy );
+    return value;
+}
+
+/// Finds several percentiles with one shared multiselect.  Percentile
+/// p is the nearest-rank value of rank p / 100 * (size - 1).
+/// @param size number of elements (at least 1)
+/// @param data original array (not modified)
+/// @param pcts percentiles in [0, 100], in any order
+/// @param npcts number of percentiles
+/// @param out filled with the value of each percentile
+/// @param nthreads threads for partitioning (0 means one per CPU)
+void select_percentiles( size_t size, const int *data, const double *pcts,
+                         size_t npcts, int *out, size_t nthreads )
+{
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+
+    size_t *ranks = malloc( ( npcts > 0 ? npcts : 1 ) * sizeof( size_t ) );
+    size_t *sorted = malloc( ( npcts > 0 ? npcts : 1 ) * sizeof( size_t ) );
+    if ( ranks == NULL || sorted == NULL ) {
+        perror( "malloc failed in select_percentiles" );
+        exit( EXIT_FAILURE );
+    }
+    for ( size_t i = 0; i < npcts; i++ ) {
+        double p = pcts[i] < 0 ? 0 : pcts[i] > 100 ? 100 : pcts[i];
+        ranks[i] = (size_t) ( p / 100.0 * (double) ( size - 1 ) + 0.5 );
+    }
+
+    /* multiselect wants ascending ranks; there are only a few */
+    memcpy( sorted, ranks, npcts * sizeof( size_t ) );
+    for ( size_t i = 1; i < npcts; i++ )
+        for ( size_t j = i; j > 0 && sorted[j - 1] > sorted[j]; j-- ) {
+            size_t t = sorted[j];
+            sorted[j] = sorted[j - 1];
+            sorted[j - 1] = t;
+        }
+
+    int *copy = select_copy( size, data );
+    multiselect( size, copy, 0, sorted, npcts, depth_limit( size ),
+                 nthreads );
+    for ( size_t i = 0; i < npcts; i++ )
+        out[i] = copy[ ranks[i] ];
+
+    free( copy );
+    free( ranks );
+    free( sorted );
+}
+
+/// Restores the min-heap property below root in heap[0, size)
+static void min_sift_down( int *heap, size_t root, size_t size )
+{
+    int v = heap[root];
+
+    for ( ;; ) {
+        size_t child = 2 * root + 1;
+        if ( child >= size )
+            break;
+        if ( child + 1 < size && heap[child + 1] < heap[child] )
+            child++;
+        if ( heap[child] >= v )
+            break;
+        heap[root] = heap[child];
+        root = child;
+    }
+    heap[root] = v;
+}
+
+/// Returns the k largest values of data, largest first.  Small k keeps
+/// a k-element min-heap over one pass of the input; larger k
+/// quickselects rank size - k on a copy and sorts the tail.
+/// @param size number of elements
+/// @param data original array (not modified)
+/// @param k number of values wanted (clamped to size)
+/// @param nthreads threads for partitioning (0 means one per CPU)
+/// @return newly allocated array of min(k, size) values (caller must free)
+int *top_k( size_t size, const int *data, size_t k, size_t nthreads )
+{
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    if ( k > size )
+        k = size;
+
+    int *result;
+    if ( k < size / TOP_K_HEAP_RATIO ) {
+        result = select_copy( k, data );
+        STAT_TIMER( t_heap );
+        for ( size_t i = k / 2; i-- > 0; )
+            min_sift_down( result, i, k );
+        for ( size_t i = k; i < size && k > 0; i++ )
+            if ( data[i] > result[0] ) {
+                result[0] = data[i];
+                min_sift_down( result, 0, k );
+            }
+        STAT_ADD( comparisons, size - k );
+        STAT_ELAPSED( t_heap, leaf_time );
+    } else {
+        int *copy = select_copy( size, data );
+        if ( k > 0 && k < size )
+            select_in_place( size, copy, size - k, nthreads );
+        memmove( copy, copy + ( size - k ), k * sizeof( int ) );
+        result = realloc( copy, ( k > 0 ? k : 1 ) * sizeof( int ) );
+        if ( result == NULL ) {
+            perror( "realloc failed in top_k" );
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    sort_in_place( k, result );
+    for ( size_t i = 0, j = k; i + 1 < j; i++, j-- ) {
+        int t = result[i];
+        result[i] = result[j - 1];
+        result[j - 1] = t;
+    }
+    return result;
+}
+
+/// Parses a comma-separated list of percentiles
+/// @return number parsed, or 0 if malformed (out is malloc'd)
+static size_t parse_percentiles( const char *s, double **out )
+{
+    size_t n = 1;
+    for ( const char *p = s; *p; p++ )
+        n += ( *p == ',' );
+    double *pcts = malloc( n * sizeof( double ) );
+    if ( pcts == NULL ) {
+        perror( "malloc" );
+        exit( EXIT_FAILURE );
+    }
+
+    for ( size_t i = 0; i < n; i++ ) {
+        char *end;
+        pcts[i] = strtod( s, &end );
+        if ( end == s || pcts[i] < 0 || pcts[i] > 100 ||
+             ( *end != ',' && *end != '\0' ) ) {
+            free( pcts );
+            return 0;
+        }
+        s = end + 1;
+    }
+    *out = pcts;
+    return n;
+}
+
+/*
+ * Distinct values and counts per value
+ *
+ * A three-way partition already gathers every copy of the pivot into
+ * one band.  The distinct sort emits that band as a single value (with
+ * its size as the count) and never looks at it again, and leaf ranges
+ * are collapsed straight after small_sort.  So duplicates drop out
+ * while sorting instead of in a pass over the sorted output, and
+ * heavily duplicated input takes far fewer partitioning levels.
+ *
+ * Ranges are finished left to right, so the next distinct value is
+ * never written past the start of the range still being sorted.  The
+ * values are therefore compacted in place at the front of the array.
+ */
+
+/// What the distinct sort reports (selected with -u)
+typedef enum {
+    DISTINCT_OFF,       ///< sort normally
+    DISTINCT_VALUES,    ///< each distinct value once
+    DISTINCT_COUNTS,    ///< each distinct value with its number of copies
+    DISTINCT_TOTAL      ///< only the number of distinct values
+} distinct_mode_t;
+
+/// Shared state of a parallel distinct sort: buckets are claimed one
+/// at a time, so buckets made large by duplicates do not stall a thread
+typedef struct {
+    const sort_task_t *buckets;
+    size_t             nbuckets;
+    int               *base;        ///< start of the bucketed copy
+    size_t            *counts;      ///< multiplicities by index, or NULL
+    size_t            *found;       ///< distinct values per bucket
+    volatile size_t    next;        ///< next bucket to claim
+} distinct_job_t;
+
+/// Appends the distinct values of the sorted data[0, size) to out[*n]
+/// and their multiplicities to counts (if not NULL).  out may alias
+/// data as long as out + *n does not lie past data.
+static void distinct_runs( size_t size, const int *data, int *out,
+                           size_t *counts, size_t *n )
+{
+    size_t k = *n;
+
+    for ( size_t i = 0; i < size; ) {
+        int v = data[i];
+        size_t j = i + 1;
+        while ( j < size && data[j] == v )
+            j++;
+        out[k] = v;
+        if ( counts != NULL )
+            counts[k] = j - i;
+        k++;
+        i = j;
+    }
+    *n = k;
+}
+
+/// Introsort that appends the distinct values of data[0, size) to
+/// out[*n] in ascending order.  It recurses on the left side first
+/// (depth_left bounds the stack) and loops on the right; the band
+/// equal to the pivot is appended as one value.
+static void distinct_loop( size_t size, int *data, int *out,
+                           size_t *counts, size_t *n, unsigned depth_left )
+{
+    STAT_LEVEL( level );
+
+    while ( size > SMALL_SORT_CUTOFF ) {
+        if ( depth_left == 0 ) {
+            heap_sort( size, data );
+            distinct_runs( size, data, out, counts, n );
+            return;
+        }
+        depth_left--;
+
+        size_t lt, gt;
+        int pivot = choose_pivot( size, data );
+        STAT_TIMER( t_part );
+        partition_range( pivot, size, data, &lt, &gt );
+        STAT_ELAPSED( t_part, partition_time );
+        STAT_PARTITION( level++, size, lt, gt );
+        if ( bad_partition( size, lt, gt ) ) {
+            break_patterns( lt, data );
+            break_patterns( size - gt, data + gt );
+        }
+
+        STAT_SET_LEVEL( level );
+        distinct_loop( lt, data, out, counts, n, depth_left );
+        if ( gt > lt ) {
+            out[*n] = pivot;
+            if ( counts != NULL )
+                counts[*n] = gt - lt;
+            ( *n )++;
+        }
+        data += gt;
+        size -= gt;
+    }
+
+    STAT_TIMER( t_leaf );
+    small_sort( size, data );
+    distinct_runs( size, data, out, counts, n );
+    STAT_ELAPSED( t_leaf, leaf_time );
+}
+
+/// Collapses buckets until none are left unclaimed.  Each bucket's
+/// values are compacted at the start of the bucket.
+static void distinct_worker( void *arg, size_t id, size_t nthreads )
+{
+    distinct_job_t *job = (distinct_job_t *) arg;
+    size_t b;
+
+    (void) id;
+    (void) nthreads;
+    while ( ( b = __sync_fetch_and_add( &job->next, 1 ) ) <
+            job->nbuckets ) {
+        const sort_task_t *t = &job->buckets[b];
+        size_t *counts = job->counts != NULL
+                         ? job->counts + ( t->data - job->base ) : NULL;
+        size_t n = 0;
+        STAT_SET_LEVEL( t->level );
+        distinct_loop( t->size, t->data, t->data, counts, &n,
+                       t->depth_left );
+        job->found[b] = n;
+    }
+}
+
+/// Sorts a copy of data while collapsing it to its distinct values.
+/// Large inputs are first distributed into buckets of value ranges
+/// (sample_distribute), and the buckets are collapsed on nthreads
+/// threads.
+/// @param size number of elements
+/// @param data original array (not modified)
+/// @param counts if not NULL, set to a new array with the number of
+///        copies of each distinct value (caller must free)
+/// @param nthreads number of threads (0 means one per online CPU)
+/// @param out_count set to the number of distinct values
+/// @return newly allocated ascending distinct values (caller must free)
+int *distinct_values( size_t size, const int *data, size_t **counts,
+                      size_t nthreads, size_t *out_count )
+{
+    int *values;
+    size_t *mult = NULL;
+    size_t n = 0;
+
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    simd_setup();
+
+    if ( counts != NULL ) {
+        mult = malloc( ( size > 0 ? size : 1 ) * sizeof( size_t ) );
+        if ( mult == NULL ) {
+            perror( "malloc failed in distinct_values" );
+            exit( EXIT_FAILURE );
+        }
+        STAT_ALLOC( size * sizeof( size_t ) );
+    }
+
+    if ( nthreads > 1 && size >= SAMPLESORT_MIN ) {
+        size_t nbuckets;
+        sort_task_t *tasks = sample_distribute( size, data, nthreads,
+                                                &nbuckets );
+        distinct_job_t job = { tasks, nbuckets, tasks[0].data, mult,
+                               malloc( nbuckets * sizeof( size_t ) ), 0 };
+        if ( job.found == NULL ) {
+            perror( "malloc failed in distinct_values" );
+            exit( EXIT_FAILURE );
+        }
+        parallel_run( nthreads, distinct_worker, &job );
+
+        /* buckets are in value order: close the gaps between them */
+        values = job.base;
+        for ( size_t b = 0; b < nbuckets; b++ ) {
+            size_t at = (size_t) ( tasks[b].data - values );
+            memmove( values + n, tasks[b].data,
+                     job.found[b] * sizeof( int ) );
+            if ( mult != NULL )
+                memmove( mult + n, mult + at,
+                         job.found[b] * sizeof( size_t ) );
+            n += job.found[b];
+        }
+        free( job.found );
+        free( tasks );
+    } else {
+        values = malloc( ( size > 0 ? size : 1 ) * sizeof( int ) );
+        if ( values == NULL ) {
+            perror( "malloc failed in distinct_values" );
+            exit( EXIT_FAILURE );
+        }
+        STAT_ALLOC( size * sizeof( int ) );
+        memcpy( values, data, size * sizeof( int ) );
+        STAT_SET_LEVEL( 0 );
+        distinct_loop( size, values, values, mult, &n, depth_limit( size ) );
+    }
+
+    values = realloc( values, ( n > 0 ? n : 1 ) * sizeof( int ) );
+    if ( mult != NULL )
+        mult = realloc( mult, ( n > 0 ? n : 1 ) * sizeof( size_t ) );
+    if ( values == NULL || ( counts != NULL && mult == NULL ) ) {
+        perror( "realloc failed in distinct_values" );
+        exit( EXIT_FAILURE );
+    }
+    if ( counts != NULL )
+        *counts = mult;
+    *out_count = n;
+    return values;
+}
+
+/*
+ * Algorithm selection
+ */
+
+/// Sorting algorithms (selected with -a)
+typedef enum {
+    ALGO_QUICK,         ///< introsort / work-stealing quicksort
+    ALGO_RADIX,         ///< LSD radix sort
+    ALGO_SAMPLE,        ///< parallel samplesort
+    ALGO_MERGE,         ///< stable parallel merge sort
+    ALGO_AUTO           ///< radix or quick by size and key range
+} sort_algorithm_t;
+
+/// Below this size quicksort always wins over radix sort's fixed passes
+#define AUTO_RADIX_MIN 4096
+
+/// Average copies per distinct key above which quicksort is preferred
+#define AUTO_DUPLICATE_RATIO 64
+
+/// Picks radix sort when its pass count is cheap relative to the
+/// log2(n) partitioning levels quicksort would need.  A pass is skipped
+/// when all keys share that digit, so a narrow key range means fewer
+/// passes; the count here comes from the bits in which min and max
+/// differ.  Inputs with many copies of each key stay with quicksort,
+/// whose three-way partition retires equal keys in one step.
+static sort_algorithm_t choose_algorithm( size_t size, const int *data )
+{
+    if ( size < AUTO_RADIX_MIN )
+        return ALGO_QUICK;
+
+    int lo = data[0], hi = data[0];
+    for ( size_t i = 1; i < size; i++ ) {
+        if ( data[i] < lo ) lo = data[i];
+        if ( data[i] > hi ) hi = data[i];
+    }
+
+    if ( (unsigned) hi - (unsigned) lo < size / AUTO_DUPLICATE_RATIO )
+        return ALGO_QUICK;
+
+    unsigned diff = ( (unsigned) lo ^ 0x80000000u ) ^
+                    ( (unsigned) hi ^ 0x80000000u );
+    unsigned passes = 0;
+    while ( diff != 0 ) {
+        diff >>= RADIX_BITS;
+        passes++;
+    }
+
+    unsigned levels = 0;
+    for ( size_t n = size; n > 1; n >>= 1 )
+        levels++;
+
+    return passes * 3 <= levels ? ALGO_RADIX : ALGO_QUICK;
+}
+
+/*
+ * Key-value sorts and argsort
+ */
+
+/// Swaps element i and j of both arrays
+static inline void kv_swap( int *keys, size_t *pay, size_t i, size_t j )
+{
+    int k = keys[i];
+    keys[i] = keys[j];
+    keys[j] = k;
+    size_t p = pay[i];
+    pay[i] = pay[j];
+    pay[j] = p;
+}
+
+static void kv_insertion_sort( size_t size, int *keys, size_t *pay )
+{
+    for ( size_t i = 1; i < size; i++ ) {
+        int k = keys[i];
+        size_t p = pay[i];
+        size_t j = i;
+        while ( j > 0 && keys[j - 1] > k ) {
+            keys[j] = keys[j - 1];
+            pay[j] = pay[j - 1];
+            j--;
+        }
+        STAT_ADD( comparisons, i - j + ( j > 0 ) );
+        STAT_ADD( moves, i - j + 1 );
+        keys[j] = k;
+        pay[j] = p;
+    }
+}
+
+static void kv_sift_down( int *keys, size_t *pay, size_t root, size_t size )
+{
+    for ( ;; ) {
+        size_t child = 2 * root + 1;
+        if ( child >= size )
+            break;
+        if ( child + 1 < size && keys[child] < keys[child + 1] )
+            child++;
+        STAT_ADD( comparisons, 2 );
+        if ( keys[root] >= keys[child] )
+            break;
+        kv_swap( keys, pay, root, child );
+        STAT_ADD( moves, 2 );
+        root = child;
+    }
+}
+
+static void kv_heap_sort( size_t size, int *keys, size_t *pay )
+{
+    STAT_TIMER( t_heap );
+    for ( size_t i = size / 2; i-- > 0; )
+        kv_sift_down( keys, pay, i, size );
+    for ( size_t end = size; end-- > 1; ) {
+        kv_swap( keys, pay, 0, end );
+        kv_sift_down( keys, pay, 0, end );
+    }
+    STAT_ELAPSED( t_heap, leaf_time );
+}
+
+/// break_patterns for keys with pay alongside
+static void kv_break_patterns( size_t size, int *keys, size_t *pay )
+{
+    if ( size <= SMALL_SORT_CUTOFF )
+        return;
+
+    size_t q = size / 4;
+    size_t swaps = size > 128 ? 3 : 1;
+
+    for ( size_t k = 0; k < swaps; k++ ) {
+        kv_swap( keys, pay, k, q + k );
+        kv_swap( keys, pay, size - 1 - k, size - 1 - k - q );
+    }
+}
+
+/// Hoare partition of keys (and pay alongside): keys below pivot, or
+/// not above it when or_equal is set, are moved to the front
+/// @param eq incremented by the number of keys equal to pivot seen on
+///           the right (may be NULL)
+/// @return number of keys moved to the front
+static size_t kv_partition2( int pivot, int or_equal, size_t size,
+                             int *keys, size_t *pay, size_t *eq )
+{
+    size_t i = 0, j = size, same = 0;
+
+    for ( ;; ) {
+        while ( i < j && ( keys[i] < pivot ||
+                           ( or_equal && keys[i] == pivot ) ) )
+            i++;
+        while ( i < j && !( keys[j - 1] < pivot ||
+                            ( or_equal && keys[j - 1] == pivot ) ) ) {
+            same += keys[j - 1] == pivot;
+            j--;
+        }
+        if ( i >= j )
+            break;
+        same += keys[i] == pivot;
+        kv_swap( keys, pay, i++, --j );
+        STAT_ADD( moves, 2 );
+    }
+    STAT_ADD( comparisons, size );
+
+    if ( eq != NULL )
+        *eq += same;
+    return i;
+}
+
+/// two_pass_partition3 for keys with pay alongside
+static void kv_partition3( int pivot, size_t size, int *keys, size_t *pay,
+                           size_t *lt, size_t *gt )
+{
+    size_t eq = 0;
+    size_t less = kv_partition2( pivot, 0, size, keys, pay, &eq );
+
+    if ( eq > 1 || less == 0 ) {
+        *lt = less;
+        *gt = less + kv_partition2( pivot, 1, size - less, keys + less,
+                                    pay + less, NULL );
+    } else {
+        *lt = *gt = less;
+    }
+}
+
+/// introsort_loop over keys, applying every move to pay as well: the
+/// same pivot choice, three-way split, pattern breaking and heapsort
+/// fallback, with insertion sort for the leaves
+static void kv_introsort_loop( size_t size, int *keys, size_t *pay,
+                               unsigned depth_left )
+{
+    STAT_LEVEL( level );
+
+    while ( size > SMALL_SORT_CUTOFF ) {
+        if ( depth_left == 0 ) {
+            kv_heap_sort( size, keys, pay );
+            return;
+        }
+        depth_left--;
+
+        size_t lt, gt;
+        STAT_TIMER( t_part );
+        kv_partition3( choose_pivot( size, keys ), size, keys, pay,
+                       &lt, &gt );
+        STAT_ELAPSED( t_part, partition_time );
+        STAT_PARTITION( level++, size, lt, gt );
+        if ( bad_partition( size, lt, gt ) ) {
+            kv_break_patterns( lt, keys, pay );
+            kv_break_patterns( size - gt, keys + gt, pay + gt );
+        }
+
+        size_t more_cnt = size - gt;
+        STAT_SET_LEVEL( level );
+        if ( lt < more_cnt ) {
+            kv_introsort_loop( lt, keys, pay, depth_left );
+            keys += gt;
+            pay += gt;
+            size = more_cnt;
+        } else {
+            kv_introsort_loop( more_cnt, keys + gt, pay + gt, depth_left );
+            size = lt;
+        }
+    }
+
+    STAT_TIMER( t_leaf );
+    kv_insertion_sort( size, keys, pay );
+    STAT_ELAPSED( t_leaf, leaf_time );
+}
+
+/// Sorts keys in place with introsort, moving payload[i] with keys[i]
+/// (structure of arrays).  Not stable.
+/// @param size number of elements
+/// @param keys keys to sort
+/// @param payload values carried with the keys
+void quicksort_pairs( size_t size, int *keys, size_t *payload )
+{
+    STAT_SET_LEVEL( 0 );
+    kv_introsort_loop( size, keys, payload, depth_limit( size ) );
+}
+
+/// Sorts key/payload pairs in place with the given engine: radix sort
+/// or merge sort (both stable and threaded) or introsort; ALGO_AUTO
+/// picks radix or introsort with choose_algorithm, and samplesort
+/// falls back to introsort
+/// @param size number of elements
+/// @param keys keys to sort
+/// @param payload values carried with the keys
+/// @param algorithm sorting engine
+/// @param nthreads threads for radix sort (0 means one per online CPU)
+void sort_pairs( size_t size, int *keys, size_t *payload,
+                 sort_algorithm_t algorithm, size_t nthreads )
+{
+    if ( algorithm == ALGO_AUTO )
+        algorithm = choose_algorithm( size, keys );
+    if ( algorithm == ALGO_RADIX )
+        radix_sort_pairs( size, keys, payload, nthreads );
+    else if ( algorithm == ALGO_MERGE )
+        merge_sort_pairs( size, keys, payload, nthreads );
+    else
+        quicksort_pairs( size, keys, payload );
+}
+
+/// Returns the permutation that sorts data: data[perm[0]] is the
+/// smallest value, data[perm[1]] the next, and so on.  With radix or
+/// merge sort equal values keep their input order.
+/// @param size number of elements
+/// @param data original array (not modified)
+/// @param algorithm sorting engine (see sort_pairs)
+/// @param nthreads threads for radix sort (0 means one per online CPU)
+/// @return newly allocated index array (caller must free)
+size_t *argsort( size_t size, const int *data, sort_algorithm_t algorithm,
+                 size_t nthreads )
+{
+    int *keys = malloc( ( size > 0 ? size : 1 ) * sizeof( int ) );
+    size_t *perm = malloc( ( size > 0 ? size : 1 ) * sizeof( size_t ) );
+    if ( keys == NULL || perm == NULL ) {
+        perror( "malloc failed in argsort" );
+        exit( EXIT_FAILURE );
+    }
+    memcpy( keys, data, size * sizeof( int ) );
+    for ( size_t i = 0; i < size; i++ )
+        perm[i] = i;
+
+    sort_pairs( size, keys, perm, algorithm, nthreads );
+    free( keys );
+    return perm;
+}
+
+/*
+ * Hardware performance counters
+ */
+
+/// Starts counting user-space branch misses of the calling thread
+/// @return counter handle, or -1 if counters are unavailable
+static int branch_misses_start( void )
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof( attr );
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+#else
+    return -1;
+#endif
+}
+
+/// Stops a counter from branch_misses_start and returns its value
+/// @return branch misses, or -1 if the counter was unavailable
+static long long branch_misses_stop( int fd )
+{
+    long long count = -1;
+
+    if ( fd < 0 )
+        return -1;
+    if ( read( fd, &count, sizeof( count ) ) != (ssize_t) sizeof( count ) )
+        count = -1;
+    close( fd );
+    return count;
+}
+
+/*
+ * File I/O
+ */
+
+/// Files smaller than this are parsed on one thread
+#define PARSE_PARALLEL_MIN ( 1 << 20 )
+
+/// Bytes sampled from the start of a file to estimate bytes per integer
+#define PARSE_SAMPLE_BYTES 65536
+
+/// Reads integers from a stream, one per line (fallback for inputs
+/// that cannot be mapped, such as pipes)
+/// @param fp open input stream
+/// @param out_size filled with number of integers read
+/// @return dynamically allocated array (caller must free)
+static int *read_integers_from_stream( FILE *fp, size_t *out_size )
+{
+    size_t capacity = 256;
+    int *data = malloc( capacity * sizeof( int ) );
+    if ( data == NULL ) {
+        perror( "malloc" );
+        exit( EXIT_FAILURE );
+    }
+
+    size_t count = 0;
+    int value;
+
+    while ( fscanf( fp, "%d", &value ) == 1 ) {
+        if ( count >= capacity ) {
+            capacity *= 2;
+            data = realloc( data, capacity * sizeof( int ) );
+            if ( data == NULL ) {
+                perror( "realloc" );
+                exit( EXIT_FAILURE );
+            }
+        }
+        data[count++] = value;
+
+        /* consume rest of line */
+        int ch;
+        while ( ( ch = fgetc( fp ) ) != '\n' && ch != EOF )
+            ;
+    }
+
+    *out_size = count;
+    return data;
+}
+
+/// Integers parsed from one newline-aligned slice of the input
+typedef struct {
+    const char *begin;
+    const char *end;
+    int        *values;
+    size_t      count;
+    size_t      capacity;
+    int         stopped;    ///< hit text that is not an integer
+} parse_chunk_t;
+
+/// Shared state of one parallel parse
+typedef struct {
+    parse_chunk_t *chunks;
+} parse_job_t;
+
+/// Returns nonzero for the characters fscanf treats as white space
+static inline int is_space( char c )
+{
+    return c == ' ' || ( c >= '\t' && c <= '\r' );
+}
+
+/// Parses one chunk with the same rules as fscanf( "%d" ) followed by
+/// skipping the rest of the line: leading white space (including blank
+/// lines) is skipped, and anything that is not a number stops the parse
+static void parse_chunk( parse_chunk_t *c )
+{
+    const char *p = c->begin, *end = c->end;
+
+    for ( ;; ) {
+        while ( p < end && is_space( *p ) )
+            p++;
+        if ( p == end )
+            break;
+
+        int neg = 0;
+        if ( *p == '-' || *p == '+' ) {
+            neg = ( *p == '-' );
+            p++;
+        }
+        if ( p == end || (unsigned) ( *p - '0' ) > 9 ) {
+            c->stopped = 1;
+            break;
+        }
+
+        unsigned v = 0;
+        while ( p < end && (unsigned) ( *p - '0' ) <= 9 )
+            v = v * 10 + (unsigned) ( *p++ - '0' );
+
+        if ( c->count == c->capacity ) {
+            c->capacity = c->capacity ? c->capacity * 2 : 1024;
+            c->values = realloc( c->values, c->capacity * sizeof( int ) );
+            if ( c->values == NULL ) {
+                perror( "realloc in parse_chunk" );
+                exit( EXIT_FAILURE );
+            }
+        }
+        c->values[ c->count++ ] = (int) ( neg ? 0u - v : v );
+
+        /* consume rest of line */
+        const char *nl = memchr( p, '\n', (size_t) ( end - p ) );
+        p = nl != NULL ? nl + 1 : end;
+    }
+}
+
+static void parse_worker( void *arg, size_t id, size_t nthreads )
+{
+    parse_job_t *job = (parse_job_t *) arg;
+    (void) nthreads;
+    parse_chunk( &job->chunks[id] );
+}
+
+/// Reads all integers from file, one per line.  The file is mapped and
+/// split at line boundaries into one slice per thread; each slice is
+/// parsed into its own buffer, pre-sized from the bytes per integer of
+/// a sample, and the buffers are concatenated.  Inputs that cannot be
+/// mapped are read with fscanf.
+/// @param filename name of input file
+/// @param out_size filled with number of integers read
+/// @return dynamically allocated array (caller must free)
+static int *read_integers_from_file( const char *filename, size_t *out_size )
+{
+    int fd = open( filename, O_RDONLY );
+    if ( fd < 0 ) {
+        perror( "open" );
+        exit( EXIT_FAILURE );
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 )
+        map = mmap( NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+                    fd, 0 );
+
+    if ( map == MAP_FAILED ) {
+        FILE *fp = fdopen( fd, "r" );
+        if ( fp == NULL ) {
+            perror( "fdopen" );
+            exit( EXIT_FAILURE );
+        }
+        int *data = read_integers_from_stream( fp, out_size );
+        fclose( fp );
+        return data;
+    }
+    close( fd );
+
+    size_t len = (size_t) st.st_size;
+    const char *text = map;
+    posix_madvise( map, len, POSIX_MADV_SEQUENTIAL );
+
+    size_t nthreads = len < PARSE_PARALLEL_MIN ? 1 : online_cpus();
+    parse_job_t job;
+    job.chunks = calloc( nthreads, sizeof( parse_chunk_t ) );
+    if ( job.chunks == NULL ) {
+        perror( "calloc" );
+        exit( EXIT_FAILURE );
+    }
+
+    /* estimate bytes per integer from the newlines in a sample */
+    size_t sample = len < PARSE_SAMPLE_BYTES ? len : PARSE_SAMPLE_BYTES;
+    size_t lines = 1;
+    for ( size_t i = 0; i < sample; i++ )
+        lines += ( text[i] == '\n' );
+    double bytes_per_int = (double) sample / (double) lines;
+
+    /* slice boundaries, each moved forward past the next newline */
+    const char *prev = text;
+    for ( size_t t = 0; t < nthreads; t++ ) {
+        const char *stop = text + len;
+        if ( t + 1 < nthreads ) {
+            const char *cut = text + len * ( t + 1 ) / nthreads;
+            if ( cut < prev )
+                cut = prev;
+            const char *nl = memchr( cut, '\n', (size_t) ( stop - cut ) );
+            stop = nl != NULL ? nl + 1 : stop;
+        }
+        job.chunks[t].begin = prev;
+        job.chunks[t].end = stop;
+        job.chunks[t].capacity =
+            (size_t) ( (double) ( stop - prev ) / bytes_per_int * 1.1 ) + 16;
+        job.chunks[t].values = malloc( job.chunks[t].capacity *
+                                       sizeof( int ) );
+        if ( job.chunks[t].values == NULL ) {
+            perror( "malloc" );
+            exit( EXIT_FAILURE );
+        }
+        prev = stop;
+    }
+
+    parallel_run( nthreads, parse_worker, &job );
+
+    /* like fscanf, stop at the first chunk that hit a non-integer */
+    size_t count = 0, used = nthreads;
+    for ( size_t t = 0; t < nthreads; t++ ) {
+        count += job.chunks[t].count;
+        if ( job.chunks[t].stopped ) {
+            used = t + 1;
+            break;
+        }
+    }
+
+    int *data = malloc( ( count > 0 ? count : 1 ) * sizeof( int ) );
+    if ( data == NULL ) {
+        perror( "malloc" );
+        exit( EXIT_FAILURE );
+    }
+    size_t at = 0;
+    for ( size_t t = 0; t < nthreads; t++ ) {
+        if ( t < used ) {
+            memcpy( data + at, job.chunks[t].values,
+                    job.chunks[t].count * sizeof( int ) );
+            at += job.chunks[t].count;
+        }
+        free( job.chunks[t].values );
+    }
+
+    free( job.chunks );
+    munmap( map, len );
+
+    *out_size = count;
+    return data;
+}
+
+/// On-disk integer formats for input (-f) and sorted output (-W)
+typedef enum {
+    FORMAT_TEXT,        ///< decimal, one integer per line
+    FORMAT_I32,         ///< raw little-endian 32-bit
+    FORMAT_I64          ///< raw little-endian 64-bit
+} int_format_t;
+
+/// Parses a format name; returns 0 on success, -1 if unknown
+static int parse_format( const char *name, int_format_t *format )
+{
+    if ( strcmp( name, "text" ) == 0 )
+        *format = FORMAT_TEXT;
+    else if ( strcmp( name, "i32" ) == 0 )
+        *format = FORMAT_I32;
+    else if ( strcmp( name, "i64" ) == 0 )
+        *format = FORMAT_I64;
+    else
+        return -1;
+    return 0;
+}
+
+/// Returns nonzero when the host stores integers little-endian
+static int host_is_little_endian( void )
+{
+    const uint16_t probe = 1;
+    return *(const unsigned char *) &probe == 1;
+}
+
+/// Decodes a little-endian integer of width bytes
+static int64_t load_le( const unsigned char *p, size_t width )
+{
+    uint64_t v = 0;
+    for ( size_t i = width; i-- > 0; )
+        v = ( v << 8 ) | p[i];
+    if ( width == 4 )
+        return (int32_t) (uint32_t) v;
+    return (int64_t) v;
+}
+
+/// Encodes v as a little-endian integer of width bytes
+static void store_le( unsigned char *p, size_t width, int64_t v )
+{
+    uint64_t u = (uint64_t) v;
+    for ( size_t i = 0; i < width; i++, u >>= 8 )
+        p[i] = (unsigned char) u;
+}
+
+/// Reads a raw little-endian int32 or int64 file.  On a little-endian
+/// host an int32 file is used straight from the mapping (*map is set
+/// and the caller must munmap it instead of freeing the array);
+/// otherwise values are copied out, and int64 values must fit in int.
+/// @param filename name of input file
+/// @param format FORMAT_I32 or FORMAT_I64
+/// @param out_size filled with number of integers read
+/// @param map filled with the mapping to release, or NULL
+/// @param map_len filled with the mapping length
+/// @return array of integers
+static int *read_integers_binary( const char *filename, int_format_t format,
+                                  size_t *out_size, void **map,
+                                  size_t *map_len )
+{
+    size_t width = format == FORMAT_I64 ? 8 : 4;
+    int fd = open( filename, O_RDONLY );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+        perror( filename );
+        exit( EXIT_FAILURE );
+    }
+
+    size_t len = (size_t) st.st_size;
+    if ( len % width != 0 ) {
+        fprintf( stderr, "Error: %s is not a whole number of %zu-byte "
+                 "integers\n", filename, width );
+        exit( EXIT_FAILURE );
+    }
+
+    *map = NULL;
+    *map_len = 0;
+    *out_size = len / width;
+    if ( len == 0 ) {
+        close( fd );
+        return malloc( sizeof( int ) );
+    }
+
+    void *m = mmap( NULL, len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( m == MAP_FAILED ) {
+        perror( "mmap" );
+        exit( EXIT_FAILURE );
+    }
+    posix_madvise( m, len, POSIX_MADV_SEQUENTIAL );
+
+    if ( width == sizeof( int ) && host_is_little_endian() ) {
+        *map = m;
+        *map_len = len;
+        return (int *) m;
+    }
+
+    int *data = malloc( *out_size * sizeof( int ) );
+    if ( data == NULL ) {
+        perror( "malloc" );
+        exit( EXIT_FAILURE );
+    }
+    const unsigned char *bytes = m;
+    for ( size_t i = 0; i < *out_size; i++ ) {
+        int64_t v = load_le( bytes + i * width, width );
+        if ( v < INT_MIN || v > INT_MAX ) {
+            fprintf( stderr, "Error: value %lld at index %zu does not fit "
+                     "in int\n", (long long) v, i );
+            exit( EXIT_FAILURE );
+        }
+        data[i] = (int) v;
+    }
+    munmap( m, len );
+    return data;
+}
+
+/// Writes all of buf to fd, retrying short writes
+static void write_all( int fd, const void *buf, size_t len )
+{
+    const char *p = buf;
+
+    while ( len > 0 ) {
+        ssize_t n = write( fd, p, len );
+        if ( n < 0 ) {
+            perror( "write" );
+            exit( EXIT_FAILURE );
+        }
+        p += n;
+        len -= (size_t) n;
+    }
+}
+
+/// Writes the sorted array to filename ("-" for standard output).
+/// Binary formats go into a file-sized shared mapping (or one large
+/// write for pipes); text is one integer per line.
+static void write_integers( const char *filename, int_format_t format,
+                            const int *data, size_t size )
+{
+    int to_stdout = strcmp( filename, "-" ) == 0;
+    if ( to_stdout )
+        fflush( stdout );       // keep the report ahead of the data
+
+    int fd = to_stdout ? STDOUT_FILENO
+                       : open( filename, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 ) {
+        perror( filename );
+        exit( EXIT_FAILURE );
+    }
+
+    if ( format == FORMAT_TEXT ) {
+        FILE *fp = to_stdout ? stdout : fdopen( fd, "w" );
+        if ( fp == NULL ) {
+            perror( "fdopen" );
+            exit( EXIT_FAILURE );
+        }
+        write_array_text( fp, data, size, "\n" );
+        if ( size > 0 )
+            fputc( '\n', fp );
+        if ( to_stdout )
+            fflush( fp );
+        else
+            fclose( fp );
+        return;
+    }
+
+    size_t width = format == FORMAT_I64 ? 8 : 4;
+    size_t len = size * width;
+    unsigned char *out = MAP_FAILED;
+
+    if ( !to_stdout && len > 0 && ftruncate( fd, (off_t) len ) == 0 )
+        out = mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+    unsigned char *buf = out;
+    if ( out == MAP_FAILED ) {
+        buf = malloc( len > 0 ? len : 1 );
+        if ( buf == NULL ) {
+            perror( "malloc" );
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    if ( width == sizeof( int ) && host_is_little_endian() )
+        memcpy( buf, data, len );
+    else
+        for ( size_t i = 0; i < size; i++ )
+            store_le( buf + i * width, width, data[i] );
+
+    if ( out != MAP_FAILED ) {
+        munmap( out, len );
+    } else {
+        write_all( fd, buf, len );
+        free( buf );
+    }
+    if ( !to_stdout )
+        close( fd );
+}
+
+/*
+ * External merge sort
+ */
+
+/// Bytes per read or write buffer of the external sort
+#define EXT_BLOCK ( 1 << 18 )
+
+/// Smallest accepted memory budget (-M): the run buffer plus the
+/// input block and parsed values must fit with room to spare
+#define EXT_MIN_BUDGET ( 16 * EXT_BLOCK )
+
+/// Input being cut into runs
+typedef struct {
+    int            fd;
+    int_format_t   format;
+    char          *buf;         ///< EXT_BLOCK bytes of raw input
+    size_t         len;         ///< bytes in buf
+    size_t         lim;         ///< end of the whole lines in buf
+    int            eof;         ///< read() returned 0
+    parse_chunk_t  chunk;       ///< values parsed from buf[0, lim)
+    size_t         taken;       ///< values of chunk already consumed
+} ext_input_t;
+
+/// One sorted run in a spill file, read back a block at a time
+typedef struct {
+    int    fd;
+    off_t  offset;      ///< file offset of the next block
+    off_t  end;         ///< file offset one past the run
+    int   *buf;         ///< EXT_BLOCK bytes
+    size_t pos, len;    ///< values consumed / held in buf
+    int    head;        ///< current smallest value of the run
+    int    done;        ///< run exhausted
+} ext_run_t;
+
+/// Double-buffered writer: the merge fills one buffer while a
+/// background thread writes the other
+typedef struct {
+    int              fd;
+    int_format_t     format;
+    int              spill;     ///< native ints (a run) instead of format
+    unsigned char   *buf[2];
+    size_t           fill;      ///< bytes in buf[cur]
+    int              cur;
+    size_t           pending;   ///< bytes of buf[cur ^ 1] being written
+    int              closing;
+    off_t            written;   ///< bytes handed to the writer thread
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    pthread_t        thread;
+} ext_writer_t;
+
+/// Reads up to len bytes, stopping early only at end of file
+static size_t read_full( int fd, void *buf, size_t len )
+{
+    char *p = buf;
+    size_t got = 0;
+
+    while ( got < len ) {
+        ssize_t n = read( fd, p + got, len - got );
+        if ( n < 0 ) {
+            perror( "read" );
+            exit( EXIT_FAILURE );
+        }
+        if ( n == 0 )
+            break;
+        got += (size_t) n;
+    }
+    return got;
+}
+
+/// Reads up to len bytes at offset, stopping early only at end of file
+static void pread_full( int fd, void *buf, size_t len, off_t offset )
+{
+    char *p = buf;
+
+    while ( len > 0 ) {
+        ssize_t n = pread( fd, p, len, offset );
+        if ( n <= 0 ) {
+            perror( "pread" );
+            exit( EXIT_FAILURE );
+        }
+        p += n;
+        len -= (size_t) n;
+        offset += n;
+    }
+}
+
+/// Keeps the partial last line of buf, reads the next block behind it
+/// and parses the whole lines with parse_chunk
+static void ext_refill_text( ext_input_t *in )
+{
+    size_t tail = in->len - in->lim;
+    memmove( in->buf, in->buf + in->lim, tail );
+    in->len = tail + read_full( in->fd, in->buf + tail, EXT_BLOCK - tail );
+    in->eof = in->len < EXT_BLOCK;
+
+    /* cut after the last newline; a line longer than the whole block
+     * is split where the block ends */
+    in->lim = in->len;
+    if ( !in->eof )
+        while ( in->lim > 0 && in->buf[in->lim - 1] != '\n' )
+            in->lim--;
+    if ( in->lim == 0 )
+        in->lim = in->len;
+
+    in->chunk.begin = in->buf;
+    in->chunk.end = in->buf + in->lim;
+    in->chunk.count = 0;
+    in->taken = 0;
+    parse_chunk( &in->chunk );
+}
+
+/// Fills run with up to cap values from the input
+/// @return number of values stored (0 at end of input)
+static size_t ext_read_run( ext_input_t *in, int *run, size_t cap )
+{
+    size_t n = 0;
+
+    if ( in->format == FORMAT_I32 && host_is_little_endian() ) {
+        size_t got = read_full( in->fd, run, cap * sizeof( int ) );
+        if ( got % sizeof( int ) != 0 ) {
+            fprintf( stderr, "Error: input is not a whole number of "
+                     "4-byte integers\n" );
+            exit( EXIT_FAILURE );
+        }
+        return got / sizeof( int );
+    }
+
+    if ( in->format != FORMAT_TEXT ) {
+        size_t width = in->format == FORMAT_I64 ? 8 : 4;
+        while ( n < cap ) {
+            size_t want = cap - n < EXT_BLOCK / width ? cap - n
+                                                      : EXT_BLOCK / width;
+            size_t got = read_full( in->fd, in->buf, want * width );
+            if ( got % width != 0 ) {
+                fprintf( stderr, "Error: input is not a whole number of "
+                         "%zu-byte integers\n", width );
+                exit( EXIT_FAILURE );
+            }
+            for ( size_t i = 0; i < got / width; i++ ) {
+                int64_t v = load_le( (unsigned char *) in->buf + i * width,
+                                     width );
+                if ( v < INT_MIN || v > INT_MAX ) {
+                    fprintf( stderr, "Error: value %lld does not fit in "
+                             "int\n", (long long) v );
+                    exit( EXIT_FAILURE );
+                }
+                run[n++] = (int) v;
+            }
+            if ( got < want * width )
+                break;
+        }
+        return n;
+    }
+
+    while ( n < cap ) {
+        if ( in->taken == in->chunk.count ) {
+            if ( in->chunk.stopped || ( in->eof && in->lim == in->len ) )
+                break;
+            ext_refill_text( in );
+            continue;
+        }
+        size_t k = in->chunk.count - in->taken;
+        if ( k > cap - n )
+            k = cap - n;
+        memcpy( run + n, in->chunk.values + in->taken, k * sizeof( int ) );
+        in->taken += k;
+        n += k;
+    }
+    return n;
+}
+
+/// Loads the next value of a run into head, reading the next block
+/// when the buffer is empty and hinting the kernel to prefetch the
+/// one after it
+static void ext_run_next( ext_run_t *r )
+{
+    if ( r->pos == r->len ) {
+        if ( r->offset == r->end ) {
+            r->done = 1;
+            return;
+        }
+        off_t left = r->end - r->offset;
+        size_t bytes = left < EXT_BLOCK ? (size_t) left : EXT_BLOCK;
+        pread_full( r->fd, r->buf, bytes, r->offset );
+        r->offset += (off_t) bytes;
+        r->pos = 0;
+        r->len = bytes / sizeof( int );
+
+        left = r->end - r->offset;
+        if ( left > 0 )
+            posix_fadvise( r->fd, r->offset,
+                           left < EXT_BLOCK ? left : EXT_BLOCK,
+                           POSIX_FADV_WILLNEED );
+    }
+    r->head = r->buf[r->pos++];
+}
+
+/// Returns nonzero when run a's head sorts before run b's; exhausted
+/// runs sort after everything
+static inline int ext_before( const ext_run_t *runs, size_t a, size_t b )
+{
+    if ( runs[a].done || runs[b].done )
+        return runs[b].done && !runs[a].done;
+    return runs[a].head < runs[b].head
+        || ( runs[a].head == runs[b].head && a < b );
+}
+
+/// Plays leaf i up a loser tree of k leaves: each internal node keeps
+/// the loser of its match and the winner moves on.  Slots equal to k
+/// are empty (only while the tree is being built).
+/// @param tree tree[0] receives the overall winner, tree[1, k) losers
+static void loser_tree_replay( size_t *tree, size_t k,
+                               const ext_run_t *runs, size_t i )
+{
+    size_t winner = i;
+
+    for ( size_t node = ( i + k ) / 2; node > 0; node /= 2 ) {
+        if ( tree[node] == k ) {
+            tree[node] = winner;
+            return;
+        }
+        STAT_ADD( comparisons, 1 );
+        if ( ext_before( runs, tree[node], winner ) ) {
+            size_t t = tree[node];
+            tree[node] = winner;
+            winner = t;
+        }
+    }
+    tree[0] = winner;
+}
+
+static void *ext_writer_thread( void *arg )
+{
+    ext_writer_t *w = (ext_writer_t *) arg;
+
+    pthread_mutex_lock( &w->lock );
+    for ( ;; ) {
+        while ( w->pending == 0 && !w->closing )
+            pthread_cond_wait( &w->cond, &w->lock );
+        if ( w->pending == 0 )
+            break;
+        const unsigned char *buf = w->buf[w->cur ^ 1];
+        size_t len = w->pending;
+        pthread_mutex_unlock( &w->lock );
+
+        write_all( w->fd, buf, len );
+
+        pthread_mutex_lock( &w->lock );
+        w->pending = 0;
+        pthread_cond_broadcast( &w->cond );
+    }
+    pthread_mutex_unlock( &w->lock );
+    return NULL;
+}
+
+/// Starts a writer on fd (spill: native ints, else format)
+static void ext_writer_open( ext_writer_t *w, int fd, int_format_t format,
+                             int spill )
+{
+    w->fd = fd;
+    w->format = format;
+    w->spill = spill;
+    w->buf[0] = malloc( EXT_BLOCK );
+    w->buf[1] = malloc( EXT_BLOCK );
+    if ( w->buf[0] == NULL || w->buf[1] == NULL ) {
+        perror( "malloc failed in ext_writer_open" );
+        exit( EXIT_FAILURE );
+    }
+    w->fill = 0;
+    w->cur = 0;
+    w->pending = 0;
+    w->closing = 0;
+    w->written = 0;
+    pthread_mutex_init( &w->lock, NULL );
+    pthread_cond_init( &w->cond, NULL );
+    if ( pthread_create( &w->thread, NULL, ext_writer_thread, w ) != 0 ) {
+        perror( "pthread_create" );
+        exit( EXIT_FAILURE );
+    }
+}
+
+/// Hands the current buffer to the writer thread once it is idle
+static void ext_writer_flush( ext_writer_t *w )
+{
+    pthread_mutex_lock( &w->lock );
+    while ( w->pending != 0 )
+        pthread_cond_wait( &w->cond, &w->lock );
+    w->pending = w->fill;
+    w->written += (off_t) w->fill;
+    w->cur ^= 1;
+    w->fill = 0;
+    pthread_cond_broadcast( &w->cond );
+    pthread_mutex_unlock( &w->lock );
+}
+
+/// Appends one value in the writer's format
+static inline void ext_put( ext_writer_t *w, int v )
+{
+    if ( w->fill > EXT_BLOCK - 12 )         // "-2147483648\n"
+        ext_writer_flush( w );
+    unsigned char *p = w->buf[w->cur] + w->fill;
+
+    if ( w->spill ) {
+        memcpy( p, &v, sizeof( int ) );
+        w->fill += sizeof( int );
+    } else if ( w->format == FORMAT_TEXT ) {
+        size_t n = format_int( (char *) p, v );
+        p[n] = '\n';
+        w->fill += n + 1;
+    } else {
+        size_t width = w->format == FORMAT_I64 ? 8 : 4;
+        store_le( p, width, v );
+        w->fill += width;
+    }
+}
+
+/// Writes what is left, waits for the writer thread and frees it
+static void ext_writer_close( ext_writer_t *w )
+{
+    if ( w->fill > 0 )
+        ext_writer_flush( w );
+    pthread_mutex_lock( &w->lock );
+    w->closing = 1;
+    pthread_cond_broadcast( &w->cond );
+    pthread_mutex_unlock( &w->lock );
+    pthread_join( w->thread, NULL );
+    pthread_cond_destroy( &w->cond );
+    pthread_mutex_destroy( &w->lock );
+    free( w->buf[0] );
+    free( w->buf[1] );
+}
+
+/// Creates an anonymous spill file in $TMPDIR (or /tmp); it is
+/// unlinked at once so it disappears when closed or on exit
+static int ext_spill_file( void )
+{
+    const char *dir = getenv( "TMPDIR" );
+    if ( dir == NULL || *dir == '\0' )
+        dir = "/tmp";
+
+    char path[PATH_MAX];
+    snprintf( path, sizeof( path ), "%s/quicksort-XXXXXX", dir );
+    int fd = mkstemp( path );
+    if ( fd < 0 ) {
+        perror( path );
+        exit( EXIT_FAILURE );
+    }
+    unlink( path );
+    return fd;
+}
+
+/// Merges k primed runs (head loaded) into w with a loser tree
+static void ext_merge_runs( ext_run_t *runs, size_t k, ext_writer_t *w )
+{
+    size_t *tree = calloc( k, sizeof( size_t ) );
+    if ( tree == NULL ) {
+        perror( "malloc failed in ext_merge_runs" );
+        exit( EXIT_FAILURE );
+    }
+
+    STAT_TIMER( t_merge );
+    for ( size_t i = 0; i < k; i++ )
+        tree[i] = k;
+    for ( size_t i = 0; i < k; i++ )
+        loser_tree_replay( tree, k, runs, i );
+
+    while ( !runs[tree[0]].done ) {
+        size_t i = tree[0];
+        ext_put( w, runs[i].head );
+        ext_run_next( &runs[i] );
+        loser_tree_replay( tree, k, runs, i );
+        STAT_ADD( moves, 1 );
+    }
+    STAT_ELAPSED( t_merge, merge_time );
+    free( tree );
+}
+
+/// Merges runs[first, first + k) of spill file fd into w with a loser
+/// tree; each run reads through its own EXT_BLOCK buffer
+static void ext_merge( int fd, const off_t *bounds, size_t first, size_t k,
+                       ext_writer_t *w )
+{
+    ext_run_t *runs = calloc( k, sizeof( ext_run_t ) );
+    if ( runs == NULL ) {
+        perror( "malloc failed in ext_merge" );
+        exit( EXIT_FAILURE );
+    }
+
+    for ( size_t i = 0; i < k; i++ ) {
+        runs[i].fd = fd;
+        runs[i].offset = bounds[first + i];
+        runs[i].end = bounds[first + i + 1];
+        runs[i].buf = malloc( EXT_BLOCK );
+        if ( runs[i].buf == NULL ) {
+            perror( "malloc failed in ext_merge" );
+            exit( EXIT_FAILURE );
+        }
+        ext_run_next( &runs[i] );
+    }
+
+    ext_merge_runs( runs, k, w );
+
+    for ( size_t i = 0; i < k; i++ )
+        free( runs[i].buf );
+    free( runs );
+}
+
+/// Statistics reported after an external sort
+typedef struct {
+    size_t values;
+    size_t runs;
+    size_t passes;
+} ext_stats_t;
+
+/// Sorts a file that need not fit in memory.  Runs of at most the
+/// memory budget are read, sorted in place on the thread pool and
+/// spilled as native ints to an unlinked temporary file; the runs are
+/// then merged with a loser tree, at most budget / EXT_BLOCK - 2 at a
+/// time (earlier passes merge groups into a new spill file), and the
+/// last pass writes the output through a write-behind buffer.
+/// @param filename input file
+/// @param in_format input format
+/// @param out_file output file ("-" for standard output)
+/// @param out_format output format
+/// @param budget memory budget in bytes (at least EXT_MIN_BUDGET)
+/// @param nthreads pool size for sorting runs (0 = one per CPU)
+/// @param stats filled with counts of values, runs and merge passes
+static void external_sort( const char *filename, int_format_t in_format,
+                           const char *out_file, int_format_t out_format,
+                           size_t budget, size_t nthreads,
+                           ext_stats_t *stats )
+{
+    ext_input_t in;
+    memset( &in, 0, sizeof( in ) );
+    in.fd = open( filename, O_RDONLY );
+    if ( in.fd < 0 ) {
+        perror( filename );
+        exit( EXIT_FAILURE );
+    }
+    posix_fadvise( in.fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+    in.format = in_format;
+    in.buf = malloc( EXT_BLOCK );
+
+    /* text needs the input block and up to EXT_BLOCK / 2 parsed values
+     * besides the run */
+    size_t cap = ( budget - 3 * EXT_BLOCK ) / sizeof( int );
+    int *run = malloc( cap * sizeof( int ) );
+    if ( in.buf == NULL || run == NULL ) {
+        perror( "malloc failed in external_sort" );
+        exit( EXIT_FAILURE );
+    }
+
+    /* run formation */
+    int spill = ext_spill_file();
+    size_t nruns = 0, max_runs = 16;
+    off_t *bounds = malloc( ( max_runs + 1 ) * sizeof( off_t ) );
+    if ( bounds == NULL ) {
+        perror( "malloc failed in external_sort" );
+        exit( EXIT_FAILURE );
+    }
+    bounds[0] = 0;
+    stats->values = 0;
+
+    size_t n;
+    while ( ( n = ext_read_run( &in, run, cap ) ) > 0 ) {
+        sort_task_t task = { run, n, depth_limit( n ), 0, NULL, 0 };
+        pool_run( &task, 1, nthreads, NULL );
+        write_all( spill, run, n * sizeof( int ) );
+
+        if ( nruns == max_runs ) {
+            max_runs *= 2;
+            bounds = realloc( bounds, ( max_runs + 1 ) * sizeof( off_t ) );
+            if ( bounds == NULL ) {
+                perror( "realloc failed in external_sort" );
+                exit( EXIT_FAILURE );
+            }
+        }
+        bounds[nruns + 1] = bounds[nruns] + (off_t) ( n * sizeof( int ) );
+        nruns++;
+        stats->values += n;
+    }
+    free( run );
+    free( in.buf );
+    free( in.chunk.values );
+    close( in.fd );
+    stats->runs = nruns;
+    stats->passes = 0;
+
+    /* intermediate passes until one merge can take every run */
+    size_t fan_in = budget / EXT_BLOCK - 2;
+    while ( nruns > fan_in ) {
+        int next = ext_spill_file();
+        ext_writer_t w;
+        ext_writer_open( &w, next, FORMAT_TEXT, 1 );
+        size_t merged = 0;
+        for ( size_t first = 0; first < nruns; first += fan_in ) {
+            size_t k = nruns - first < fan_in ? nruns - first : fan_in;
+            ext_merge( spill, bounds, first, k, &w );
+            if ( w.fill > 0 )
+                ext_writer_flush( &w );
+            bounds[++merged] = w.written;
+        }
+        ext_writer_close( &w );
+        close( spill );
+        spill = next;
+        nruns = merged;
+        stats->passes++;
+    }
+
+    /* final pass */
+    int to_stdout = strcmp( out_file, "-" ) == 0;
+    if ( to_stdout )
+        fflush( stdout );
+    int out = to_stdout ? STDOUT_FILENO
+                        : open( out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( out < 0 ) {
+        perror( out_file );
+        exit( EXIT_FAILURE );
+    }
+    ext_writer_t w;
+    ext_writer_open( &w, out, out_format, 0 );
+    if ( nruns > 0 )
+        ext_merge( spill, bounds, 0, nruns, &w );
+    ext_writer_close( &w );
+    stats->passes++;
+
+    if ( !to_stdout )
+        close( out );
+    close( spill );
+    free( bounds );
+}
+
+/*
+ * Incremental updates of a sorted base file
+ */
+
+/// Statistics of one incremental update
+typedef struct {
+    size_t base;        ///< values in the base file afterwards
+    size_t deltas;      ///< delta files waiting to be merged
+    int    merged;      ///< the base was rewritten
+} update_stats_t;
+
+/// Primes r to read all of the sorted native-int file path; a missing
+/// file reads as an empty run
+static void ext_run_file( ext_run_t *r, const char *path )
+{
+    struct stat st;
+
+    memset( r, 0, sizeof( *r ) );
+    r->fd = open( path, O_RDONLY );
+    if ( r->fd < 0 ) {
+        if ( errno != ENOENT ) {
+            perror( path );
+            exit( EXIT_FAILURE );
+        }
+    } else {
+        if ( fstat( r->fd, &st ) != 0 ||
+             st.st_size % (off_t) sizeof( int ) != 0 ) {
+            fprintf( stderr, "Error: %s is not a file of %zu-byte "
+                     "integers\n", path, sizeof( int ) );
+            exit( EXIT_FAILURE );
+        }
+        r->end = st.st_size;
+        r->buf = malloc( EXT_BLOCK );
+        if ( r->buf == NULL ) {
+            perror( "malloc failed in ext_run_file" );
+            exit( EXIT_FAILURE );
+        }
+        posix_fadvise( r->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+    }
+    ext_run_next( r );
+}
+
+/// Primes r to read the sorted array data[0, size) from memory
+static void ext_run_memory( ext_run_t *r, int *data, size_t size )
+{
+    memset( r, 0, sizeof( *r ) );
+    r->fd = -1;
+    r->buf = data;
+    r->len = size;
+    ext_run_next( r );
+}
+
+/// Writes size native ints to a new file path
+static void write_run_file( const char *path, const int *data, size_t size )
+{
+    int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 ) {
+        perror( path );
+        exit( EXIT_FAILURE );
+    }
+    write_all( fd, data, size * sizeof( int ) );
+    if ( fsync( fd ) != 0 || close( fd ) != 0 ) {
+        perror( path );
+        exit( EXIT_FAILURE );
+    }
+}
+
+/// Flushes the directory entry of path (its rename or unlink) to disk
+static void fsync_parent( const char *path )
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr( path, '/' );
+    if ( slash == NULL )
+        strcpy( dir, "." );
+    else if ( slash == path )
+        strcpy( dir, "/" );
+    else
+        snprintf( dir, sizeof( dir ), "%.*s", (int) ( slash - path ),
+                  path );
+
+    int fd = open( dir, O_RDONLY );
+    if ( fd < 0 || fsync( fd ) != 0 ) {
+        perror( dir );
+        exit( EXIT_FAILURE );
+    }
+    close( fd );
+}
+
+/// Renames from to to and flushes the directory, exiting on failure
+static void rename_durable( const char *from, const char *to )
+{
+    if ( rename( from, to ) != 0 ) {
+        perror( "rename" );
+        exit( EXIT_FAILURE );
+    }
+    fsync_parent( to );
+}
+
+/// Finishes a merge that was committed but not yet installed: once
+/// base_path.new exists it holds the base and every delta, so the
+/// deltas are removed first and base_path.new then replaces the base.
+/// A crash anywhere in between leaves base_path.new for the next call.
+static void update_recover( const char *base_path )
+{
+    char path[PATH_MAX], delta[PATH_MAX];
+
+    snprintf( path, sizeof( path ), "%s.new", base_path );
+    if ( access( path, F_OK ) != 0 )
+        return;
+
+    for ( size_t i = 1;; i++ ) {
+        snprintf( delta, sizeof( delta ), "%s.delta.%zu", base_path, i );
+        if ( unlink( delta ) != 0 ) {
+            if ( errno == ENOENT )
+                break;
+            perror( delta );
+            exit( EXIT_FAILURE );
+        }
+    }
+    fsync_parent( path );
+    rename_durable( path, base_path );
+}
+
+/// Adds a sorted batch to the sorted base file base_path (raw native
+/// int32, i.e. -f i32 on little-endian hosts; created if missing).
+/// Without tiering the batch and the base are merged in one streaming
+/// pass into base_path.tmp, which then replaces the base.  With tiers
+/// > 0 the batch is only written as base_path.delta.N, and base and
+/// deltas are merged together once tiers deltas have accumulated (an
+/// LSM-style tiered merge), so most updates cost O(batch) I/O.
+/// Every file is written under base_path.tmp and renamed into place.
+/// A finished merge is committed by renaming it to base_path.new; the
+/// merged deltas are removed before it replaces the base (see
+/// update_recover), so no value is ever counted twice.
+/// @param base_path sorted base file
+/// @param sorted sorted batch
+/// @param size number of values in the batch
+/// @param tiers deltas kept before a merge (0 = merge every batch)
+/// @param stats filled with the state after the update
+static void update_base( const char *base_path, int *sorted, size_t size,
+                         size_t tiers, update_stats_t *stats )
+{
+    char path[PATH_MAX], tmp[PATH_MAX];
+    size_t ndeltas = 0;
+
+    update_recover( base_path );
+    snprintf( tmp, sizeof( tmp ), "%s.tmp", base_path );
+
+    /* existing deltas are numbered from 1 without gaps */
+    for ( ;; ) {
+        snprintf( path, sizeof( path ), "%s.delta.%zu", base_path,
+                  ndeltas + 1 );
+        if ( access( path, F_OK ) != 0 )
+            break;
+        ndeltas++;
+    }
+
+    struct stat st;
+    off_t base_bytes = stat( base_path, &st ) == 0 ? st.st_size : 0;
+
+    if ( tiers > 0 && ndeltas + 1 < tiers ) {
+        snprintf( path, sizeof( path ), "%s.delta.%zu", base_path,
+                  ndeltas + 1 );
+        write_run_file( tmp, sorted, size );
+        rename_durable( tmp, path );
+        stats->base = (size_t) base_bytes / sizeof( int );
+        stats->deltas = ndeltas + 1;
+        stats->merged = 0;
+        return;
+    }
+
+    /* merge base, every delta and the batch into a new base */
+    size_t k = ndeltas + 2;
+    ext_run_t *runs = calloc( k, sizeof( ext_run_t ) );
+    if ( runs == NULL ) {
+        perror( "malloc failed in update_base" );
+        exit( EXIT_FAILURE );
+    }
+    ext_run_file( &runs[0], base_path );
+    for ( size_t i = 1; i <= ndeltas; i++ ) {
+        snprintf( path, sizeof( path ), "%s.delta.%zu", base_path, i );
+        ext_run_file( &runs[i], path );
+    }
+    ext_run_memory( &runs[k - 1], sorted, size );
+
+    int fd = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 ) {
+        perror( tmp );
+        exit( EXIT_FAILURE );
+    }
+    ext_writer_t w;
+    ext_writer_open( &w, fd, FORMAT_I32, 1 );
+    ext_merge_runs( runs, k, &w );
+    ext_writer_close( &w );
+    if ( fsync( fd ) != 0 || close( fd ) != 0 ) {
+        perror( tmp );
+        exit( EXIT_FAILURE );
+    }
+    stats->base = (size_t) w.written / sizeof( int );
+
+    for ( size_t i = 0; i + 1 < k; i++ ) {
+        if ( runs[i].fd >= 0 )
+            close( runs[i].fd );
+        free( runs[i].buf );
+    }
+    free( runs );
+
+    /* commit point: from here on the merge survives a crash */
+    snprintf( path, sizeof( path ), "%s.new", base_path );
+    rename_durable( tmp, path );
+    update_recover( base_path );
+    stats->deltas = 0;
+    stats->merged = 1;
+}
+
+/*
+ * Streaming sort of standard input
+ */
+
+/// Bytes of input handed to a worker at a time
+#define STREAM_CHUNK ( 1 << 22 )
+
+/// Chunks read ahead of the workers, per worker, before the reader waits
+#define STREAM_INFLIGHT 2
+
+/// One chunk of input: raw bytes until a worker parses and sorts it
+typedef struct {
+    char   *bytes;
+    size_t  len;
+    int    *values;     ///< sorted values of the chunk
+    size_t  count;
+    int     stopped;    ///< text hit something that is not an integer
+} stream_chunk_t;
+
+/// Shared state of one streaming sort
+typedef struct {
+    int_format_t     format;
+    stream_chunk_t **chunks;    ///< in input order
+    size_t           nchunks;
+    size_t           capacity;
+    size_t           next;      ///< first chunk no worker has taken
+    size_t           inflight;  ///< chunks read but not yet sorted
+    int              eof;
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+} stream_job_t;
+
+/// Parses (or decodes) one chunk and sorts its values
+static void stream_process( int_format_t format, stream_chunk_t *c )
+{
+    if ( format == FORMAT_TEXT ) {
+        parse_chunk_t pc;
+        memset( &pc, 0, sizeof( pc ) );
+        pc.begin = c->bytes;
+        pc.end = c->bytes + c->len;
+        parse_chunk( &pc );
+        c->values = pc.values;
+        c->count = pc.count;
+        c->stopped = pc.stopped;
+    } else {
+        size_t width = format == FORMAT_I64 ? 8 : 4;
+        c->count = c->len / width;
+        c->values = malloc( ( c->count > 0 ? c->count : 1 ) *
+                            sizeof( int ) );
+        if ( c->values == NULL ) {
+            perror( "malloc failed in stream_process" );
+            exit( EXIT_FAILURE );
+        }
+        for ( size_t i = 0; i < c->count; i++ ) {
+            int64_t v = load_le( (unsigned char *) c->bytes + i * width,
+                                 width );
+            if ( v < INT_MIN || v > INT_MAX ) {
+                fprintf( stderr, "Error: value %lld does not fit in "
+                         "int\n", (long long) v );
+                exit( EXIT_FAILURE );
+            }
+            c->values[i] = (int) v;
+        }
+    }
+    free( c->bytes );
+    c->bytes = NULL;
+
+    if ( !adaptive_sort( c->count, c->values, 1, NULL ) )
+        sort_in_place( c->count, c->values );
+}
+
+/// Worker body: sort chunks as they arrive until input ends
+static void *stream_worker( void *arg )
+{
+    stream_job_t *job = (stream_job_t *) arg;
+
+    pthread_mutex_lock( &job->lock );
+    for ( ;; ) {
+        while ( job->next == job->nchunks && !job->eof )
+            pthread_cond_wait( &job->cond, &job->lock );
+        if ( job->next == job->nchunks )
+            break;
+        stream_chunk_t *c = job->chunks[ job->next++ ];
+        pthread_mutex_unlock( &job->lock );
+
+        stream_process( job->format, c );
+
+        pthread_mutex_lock( &job->lock );
+        job->inflight--;
+        pthread_cond_broadcast( &job->cond );
+    }
+    pthread_mutex_unlock( &job->lock );
+    return NULL;
+}
+
+/// Queues a chunk for the workers, first waiting while too many are
+/// still unsorted so raw input does not pile up
+static void stream_push( stream_job_t *job, stream_chunk_t *c,
+                         size_t max_inflight )
+{
+    pthread_mutex_lock( &job->lock );
+    while ( job->inflight >= max_inflight )
+        pthread_cond_wait( &job->cond, &job->lock );
+    if ( job->nchunks == job->capacity ) {
+        job->capacity = job->capacity ? job->capacity * 2 : 64;
+        job->chunks = realloc( job->chunks,
+                               job->capacity * sizeof( *job->chunks ) );
+        if ( job->chunks == NULL ) {
+            perror( "realloc failed in stream_push" );
+            exit( EXIT_FAILURE );
+        }
+    }
+    job->chunks[ job->nchunks++ ] = c;
+    job->inflight++;
+    pthread_cond_broadcast( &job->cond );
+    pthread_mutex_unlock( &job->lock );
+}
+
+/// Merges k sorted in-memory runs into out with the loser tree
+static void merge_memory_runs( ext_run_t *runs, size_t k, int *out )
+{
+    size_t *tree = calloc( k, sizeof( size_t ) );
+    if ( tree == NULL ) {
+        perror( "malloc failed in merge_memory_runs" );
+        exit( EXIT_FAILURE );
+    }
+
+    STAT_TIMER( t_merge );
+    for ( size_t i = 0; i < k; i++ )
+        tree[i] = k;
+    for ( size_t i = 0; i < k; i++ )
+        loser_tree_replay( tree, k, runs, i );
+
+    while ( !runs[tree[0]].done ) {
+        size_t i = tree[0];
+        *out++ = runs[i].head;
+        ext_run_next( &runs[i] );
+        loser_tree_replay( tree, k, runs, i );
+        STAT_ADD( moves, 1 );
+    }
+    STAT_ELAPSED( t_merge, merge_time );
+    free( tree );
+}
+
+/// Sorts integers read from fd (a pipe or terminal is fine) while they
+/// arrive: the calling thread reads STREAM_CHUNK-byte chunks cut at
+/// line (or value) boundaries, worker threads parse and sort each
+/// chunk as soon as it is queued, and the sorted chunks are k-way
+/// merged once input ends.  As with files, text input stops at the
+/// first line that is not an integer.
+/// @param fd input descriptor
+/// @param format input format
+/// @param nthreads worker threads (0 means one per online CPU)
+/// @param out_size filled with number of integers read
+/// @param out_chunks filled with number of chunks
+/// @return newly allocated sorted array (caller must free)
+static int *stream_sort( int fd, int_format_t format, size_t nthreads,
+                         size_t *out_size, size_t *out_chunks )
+{
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+    simd_setup();
+
+    stream_job_t job;
+    memset( &job, 0, sizeof( job ) );
+    job.format = format;
+    pthread_mutex_init( &job.lock, NULL );
+    pthread_cond_init( &job.cond, NULL );
+
+    pthread_t *threads = malloc( nthreads * sizeof( pthread_t ) );
+    char *carry = malloc( STREAM_CHUNK );
+    if ( threads == NULL || carry == NULL ) {
+        perror( "malloc failed in stream_sort" );
+        exit( EXIT_FAILURE );
+    }
+    size_t started = 0;
+    for ( ; started < nthreads; started++ )
+        if ( pthread_create( &threads[started], NULL, stream_worker,
+                             &job ) != 0 )
+            break;
+
+    /* read; the partial line (or value) at the end of each chunk is
+     * carried into the next one */
+    size_t width = format == FORMAT_I64 ? 8 : 4;
+    size_t tail = 0;
+    int eof = 0;
+    while ( !eof ) {
+        char *buf = malloc( STREAM_CHUNK + tail );
+        stream_chunk_t *c = calloc( 1, sizeof( stream_chunk_t ) );
+        if ( buf == NULL || c == NULL ) {
+            perror( "malloc failed in stream_sort" );
+            exit( EXIT_FAILURE );
+        }
+        memcpy( buf, carry, tail );
+        size_t got = read_full( fd, buf + tail, STREAM_CHUNK );
+        size_t len = tail + got;
+        eof = got < STREAM_CHUNK;
+
+        size_t cut = len;
+        if ( !eof ) {
+            if ( format == FORMAT_TEXT ) {
+                while ( cut > 0 && buf[cut - 1] != '\n' )
+                    cut--;
+                if ( cut == 0 )
+                    cut = len;      // a line longer than a chunk
+            } else {
+                cut -= len % width;
+            }
+        } else if ( format != FORMAT_TEXT && len % width != 0 ) {
+            fprintf( stderr, "Error: input is not a whole number of "
+                     "%zu-byte integers\n", width );
+            exit( EXIT_FAILURE );
+        }
+        tail = len - cut;
+        memcpy( carry, buf + cut, tail );
+
+        c->bytes = buf;
+        c->len = cut;
+        if ( started > 0 ) {
+            stream_push( &job, c, nthreads * STREAM_INFLIGHT );
+        } else {
+            /* no worker could be started: sort on this thread */
+            stream_push( &job, c, SIZE_MAX );
+            stream_process( format, c );
+            job.inflight--;
+            job.next++;
+        }
+    }
+
+    pthread_mutex_lock( &job.lock );
+    job.eof = 1;
+    pthread_cond_broadcast( &job.cond );
+    pthread_mutex_unlock( &job.lock );
+    for ( size_t i = 0; i < started; i++ )
+        pthread_join( threads[i], NULL );
+
+    /* like fscanf, nothing after the first chunk that stopped counts */
+    size_t used = job.nchunks, total = 0;
+    for ( size_t i = 0; i < job.nchunks; i++ ) {
+        total += job.chunks[i]->count;
+        if ( job.chunks[i]->stopped ) {
+            used = i + 1;
+            break;
+        }
+    }
+
+    int *sorted = malloc( ( total > 0 ? total : 1 ) * sizeof( int ) );
+    ext_run_t *runs = calloc( used > 0 ? used : 1, sizeof( ext_run_t ) );
+    if ( sorted == NULL || runs == NULL ) {
+        perror( "malloc failed in stream_sort" );
+        exit( EXIT_FAILURE );
+    }
+    for ( size_t i = 0; i < used; i++ )
+        ext_run_memory( &runs[i], job.chunks[i]->values,
+                        job.chunks[i]->count );
+    if ( used > 0 )
+        merge_memory_runs( runs, used, sorted );
+
+    for ( size_t i = 0; i < job.nchunks; i++ ) {
+        free( job.chunks[i]->values );
+        free( job.chunks[i] );
+    }
+    free( runs );
+    free( job.chunks );
+    free( threads );
+    free( carry );
+    pthread_cond_destroy( &job.cond );
+    pthread_mutex_destroy( &job.lock );
+
+    *out_size = total;
+    *out_chunks = job.nchunks;
+    return sorted;
+}
+
+/// Parses a non-negative decimal count: digits only, no sign or suffix
+/// @param s text to parse
+/// @param out receives the value
+/// @return 0 on success, -1 if s is not a number or does not fit
+static int parse_count( const char *s, size_t *out )
+{
+    if ( *s < '0' || *s > '9' )
+        return -1;
+
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull( s, &end, 10 );
+    if ( *end != '\0' || errno == ERANGE || v > SIZE_MAX )
+        return -1;
+    *out = (size_t) v;
+    return 0;
+}
+
+/// Parses a memory budget: a number with an optional k, m or g suffix
+/// (default m)
+/// @return budget in bytes, or 0 if malformed
+static size_t parse_budget( const char *s )
+{
+    char *end;
+    unsigned long long v = strtoull( s, &end, 10 );
+    if ( end == s )
+        return 0;
+
+    switch ( *end ) {
+        case 'k': case 'K':
+            v <<= 10;
+            end++;
+            break;
+        case 'g': case 'G':
+            v <<= 30;
+            end++;
+            break;
+        case 'm': case 'M':
+            end++;
+            /* fall through */
+        case '\0':
+            v <<= 20;
+            break;
+        default:
+            return 0;
+    }
+    return *end == '\0' ? (size_t) v : 0;
+}
+
+/*
+ * Benchmark harness
+ */
+
+/// Returns the current time of clk in seconds
+static double clock_seconds( clockid_t clk )
+{
+    struct timespec ts;
+    clock_gettime( clk, &ts );
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+/// Generated input distributions
+typedef enum {
+    DIST_RANDOM,
+    DIST_SORTED,
+    DIST_REVERSED,
+    DIST_FEW_UNIQUE,
+    DIST_ORGAN_PIPE,
+    DIST_ZIPF,
+    DIST_SORTED_TAIL,
+    DIST_COUNT
+} distribution_t;
+
+static const char *const distribution_names[DIST_COUNT] = {
+    "random", "sorted", "reversed", "few-unique", "organ-pipe", "zipf",
+    "sorted-tail"
+};
+
+/// Ranks of the Zipf distribution: min( size, ZIPF_MAX_RANKS )
+#define ZIPF_MAX_RANKS ( 1 << 20 )
+
+/// Largest Zipf exponent accepted by -z
+#define ZIPF_MAX_SKEW 10.0
+
+/// Exponent s of the Zipf distribution, P(k) ~ k^-s (set with -z)
+static double zipf_skew = 1.0;
+
+/// Cumulative Zipf weights: cdf[k - 1] = sum of j^-skew, j = 1 .. k
+static double *zipf_table( size_t n, double skew )
+{
+    double *cdf = malloc( n * sizeof( double ) );
+    if ( cdf == NULL ) {
+        perror( "malloc failed in zipf_table" );
+        exit( EXIT_FAILURE );
+    }
+
+    double total = 0.0;
+    for ( size_t k = 1; k <= n; k++ ) {
+        total += pow( (double) k, -skew );
+        cdf[k - 1] = total;
+    }
+    return cdf;
+}
+
+/// Fills data with size values of the given distribution; the same
+/// seed always yields the same input
+static void generate_input( distribution_t dist, size_t size, int *data,
+                            unsigned long long seed )
+{
+    size_t ranks = size < ZIPF_MAX_RANKS ? size : ZIPF_MAX_RANKS;
+    double *zipf = NULL;
+    if ( dist == DIST_ZIPF && ranks > 0 )
+        zipf = zipf_table( ranks, zipf_skew );
+
+    for ( size_t i = 0; i < size; i++ ) {
+        unsigned long long r = mix64( seed + i );
+        switch ( dist ) {
+            case DIST_RANDOM:
+                data[i] = (int) (unsigned) r;
+                break;
+            case DIST_SORTED:
+                data[i] = (int) i;
+                break;
+            case DIST_REVERSED:
+                data[i] = (int) ( size - i );
+                break;
+            case DIST_FEW_UNIQUE:
+                data[i] = (int) ( r % 16 );
+                break;
+            case DIST_ORGAN_PIPE:
+                data[i] = (int) ( i < size / 2 ? i : size - i );
+                break;
+            case DIST_SORTED_TAIL:      // sorted, then 1% new values
+                data[i] = i < size - size / 100 ? (int) i : (int) (unsigned) r;
+                break;
+            case DIST_ZIPF: {
+                /* rank k, 1-based, with P(k) = k^-s / sum of j^-s:
+                 * the first k whose cumulative weight passes u */
+                double u = ( (double) ( r >> 11 ) + 0.5 ) /
+                           9007199254740992.0 * zipf[ranks - 1];
+                size_t lo = 0, hi = ranks - 1;
+                while ( lo < hi ) {
+                    size_t mid = lo + ( hi - lo ) / 2;
+                    if ( zipf[mid] < u )
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+                data[i] = (int) ( lo + 1 );
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    free( zipf );
+}
+
+/// One algorithm configuration run by the benchmark
+typedef struct {
+    const char *name;
+    int       *( *run )( size_t size, const int *data, size_t nthreads );
+    int         threaded;   ///< uses the -t thread count (else 1)
+} bench_variant_t;
+
+static int *bench_quick( size_t size, const int *data, size_t nthreads )
+{
+    (void) nthreads;
+    return quicksort( size, data );
+}
+
+static int *bench_pool( size_t size, const int *data, size_t nthreads )
+{
+    return threaded_quicksort( size, data, nthreads, NULL );
+}
+
+static int *bench_radix( size_t size, const int *data, size_t nthreads )
+{
+    return radix_sort( size, data, nthreads );
+}
+
+static int *bench_sample( size_t size, const int *data, size_t nthreads )
+{
+    return samplesort( size, data, nthreads, NULL );
+}
+
+static int *bench_merge( size_t size, const int *data, size_t nthreads )
+{
+    return merge_sort( size, data, nthreads );
+}
+
+static const bench_variant_t bench_variants[] = {
+    { "quick",          bench_quick,  0 },
+    { "quick-threaded", bench_pool,   1 },
+    { "radix",          bench_radix,  0 },
+    { "radix-threaded", bench_radix,  1 },
+    { "sample",         bench_sample, 1 },
+    { "merge",          bench_merge,  0 },
+    { "merge-threaded", bench_merge,  1 },
+};
+
+/// qsort comparator for the reference result every variant must match
+static int compare_int( const void *a, const void *b )
+{
+    int x = *(const int *) a, y = *(const int *) b;
+    return ( x > y ) - ( x < y );
+}
+
+static int compare_double( const void *a, const void *b )
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return ( x > y ) - ( x < y );
+}
+
+/// Returns the p-th percentile (0..100) of n sorted samples
+static double percentile( const double *sorted, size_t n, double p )
+{
+    size_t idx = (size_t) ( p / 100.0 * (double) ( n - 1 ) + 0.5 );
+    return sorted[ idx < n ? idx : n - 1 ];
+}
+
+/*
+ * Type-generic sorts (sort_generic.h) against qsort
+ */
+
+SORT_GENERIC_DEFINE( sort_i32, int32_t,  SORT_LESS )
+SORT_GENERIC_DEFINE( sort_i64, int64_t,  SORT_LESS )
+SORT_GENERIC_DEFINE( sort_u64, uint64_t, SORT_LESS )
+SORT_GENERIC_DEFINE( sort_f32, float,    SORT_LESS_FLOAT )
+SORT_GENERIC_DEFINE( sort_f64, double,   SORT_LESS_FLOAT )
+
+/// qsort comparators and conversions from the generated int input
+/// (order preserving, so every distribution keeps its shape)
+#define TYPED_HELPERS( suffix, type, convert )                              \
+static int compare_##suffix( const void *a, const void *b )                 \
+{                                                                           \
+    type x = *(const type *) a, y = *(const type *) b;                      \
+    return ( x > y ) - ( x < y );                                           \
+}                                                                           \
+static void convert_##suffix( size_t size, const int *in, void *out )       \
+{                                                                           \
+    type *o = out;                                                          \
+    for ( size_t i = 0; i < size; i++ )                                     \
+        o[i] = convert( in[i] );                                            \
+}                                                                           \
+static void generic_##suffix( size_t size, void *data )                     \
+{                                                                           \
+    sort_##suffix( size, data );                                            \
+}
+
+#define TO_I32( x ) ( (int32_t) ( x ) )
+#define TO_I64( x ) ( (int64_t) ( x ) * 2147483659LL )
+#define TO_U64( x ) ( (uint64_t) ( (int64_t) ( x ) + 2147483648LL ) << 31 )
+#define TO_F32( x ) ( (float) ( x ) )
+#define TO_F64( x ) ( (double) ( x ) / 3.0 )
+
+TYPED_HELPERS( i32, int32_t,  TO_I32 )
+TYPED_HELPERS( i64, int64_t,  TO_I64 )
+TYPED_HELPERS( u64, uint64_t, TO_U64 )
+TYPED_HELPERS( f32, float,    TO_F32 )
+TYPED_HELPERS( f64, double,   TO_F64 )
+
+/// One element type benchmarked by -b: the generic sort and qsort
+typedef struct {
+    const char *generic_name;
+    const char *qsort_name;
+    size_t      width;
+    void      ( *convert )( size_t size, const int *in, void *out );
+    void      ( *sort )( size_t size, void *data );
+    int       ( *compare )( const void *a, const void *b );
+} typed_variant_t;
+
+static const typed_variant_t typed_variants[] = {
+    { "generic-i32", "qsort-i32", sizeof( int32_t ),
+      convert_i32, generic_i32, compare_i32 },
+    { "generic-i64", "qsort-i64", sizeof( int64_t ),
+      convert_i64, generic_i64, compare_i64 },
+    { "generic-u64", "qsort-u64", sizeof( uint64_t ),
+      convert_u64, generic_u64, compare_u64 },
+    { "generic-f32", "qsort-f32", sizeof( float ),
+      convert_f32, generic_f32, compare_f32 },
+    { "generic-f64", "qsort-f64", sizeof( double ),
+      convert_f64, generic_f64, compare_f64 },
+};
+
+/// Prints one CSV row from the per-run samples (sorting them)
+static void bench_report( const char *dist, const char *algorithm,
+                          size_t threads, size_t size, size_t runs,
+                          double *wall, double *tcpu, double *pcpu,
+                          int verified )
+{
+    qsort( wall, runs, sizeof( double ), compare_double );
+    qsort( tcpu, runs, sizeof( double ), compare_double );
+    qsort( pcpu, runs, sizeof( double ), compare_double );
+    printf( "%s,%s,%zu,%zu,%zu,%.6f,%.6f,%.6f,%.6f,%.6f,%s\n",
+            dist, algorithm, threads, size, runs,
+            wall[0], percentile( wall, runs, 50 ),
+            percentile( wall, runs, 95 ),
+            percentile( tcpu, runs, 50 ),
+            percentile( pcpu, runs, 50 ),
+            verified ? "yes" : "NO" );
+    fflush( stdout );
+}
 
-    if ( total > 0 && result == NULL ) {
-        perror( "malloc failed in merge_partitions" );
+/// Times the generic sort and qsort of one element type on input;
+/// the generic result must match qsort's byte for byte
+static void bench_typed( const typed_variant_t *tv, const char *dist,
+                         size_t size, const int *input, size_t runs,
+                         double *wall, double *tcpu, double *pcpu )
+{
+    size_t bytes = size * tv->width;
+    unsigned char *base = malloc( bytes );
+    unsigned char *work = malloc( bytes );
+    unsigned char *expect = malloc( bytes );
+    if ( base == NULL || work == NULL || expect == NULL ) {
+        perror( "malloc failed in bench_typed" );
         exit( EXIT_FAILURE );
     }
+    tv->convert( size, input, base );
+    memcpy( expect, base, bytes );
+    qsort( expect, size, tv->width, tv->compare );
 
-    memcpy( result,              less, less_cnt * sizeof( int ) );
-    memcpy( result + less_cnt,   same, same_cnt * sizeof( int ) );
-    memcpy( result + less_cnt + same_cnt, more, more_cnt * sizeof( int ) );
+    for ( int use_qsort = 0; use_qsort <= 1; use_qsort++ ) {
+        int verified = 1;
+        for ( size_t r = 0; r < runs; r++ ) {
+            memcpy( work, base, bytes );
+            double w0 = clock_seconds( CLOCK_MONOTONIC );
+            double t0 = clock_seconds( CLOCK_THREAD_CPUTIME_ID );
+            double p0 = clock_seconds( CLOCK_PROCESS_CPUTIME_ID );
+            if ( use_qsort )
+                qsort( work, size, tv->width, tv->compare );
+            else
+                tv->sort( size, work );
+            pcpu[r] = clock_seconds( CLOCK_PROCESS_CPUTIME_ID ) - p0;
+            tcpu[r] = clock_seconds( CLOCK_THREAD_CPUTIME_ID ) - t0;
+            wall[r] = clock_seconds( CLOCK_MONOTONIC ) - w0;
 
-    return result;
+            verified &= memcmp( work, expect, bytes ) == 0;
+        }
+        bench_report( dist, use_qsort ? tv->qsort_name : tv->generic_name,
+                      1, size, runs, wall, tcpu, pcpu, verified );
+    }
+
+    free( base );
+    free( work );
+    free( expect );
 }
 
-/// Prints array as comma-separated values (no trailing comma or newline)
-static void print_array( const int *arr, size_t size )
+/// Runs every variant on every distribution runs times and prints one
+/// CSV row each: wall-clock min/median/p95 (monotonic clock), median
+/// CPU time of the calling thread and of the whole process, and
+/// whether every result matched qsort's byte for byte.  The generic
+/// sorts of each element type follow, timed against qsort on the same
+/// values.
+static void run_benchmark( size_t size, size_t runs, size_t nthreads )
 {
-    for ( size_t i = 0; i < size; i++ ) {
-        if ( i > 0 ) printf( ", " );
-        printf( "%d", arr[i] );
+    int *input = malloc( size * sizeof( int ) );
+    int *expect = malloc( size * sizeof( int ) );
+    double *wall = malloc( runs * sizeof( double ) );
+    double *tcpu = malloc( runs * sizeof( double ) );
+    double *pcpu = malloc( runs * sizeof( double ) );
+    if ( input == NULL || expect == NULL || wall == NULL || tcpu == NULL ||
+         pcpu == NULL ) {
+        perror( "malloc failed in run_benchmark" );
+        exit( EXIT_FAILURE );
+    }
+    if ( nthreads == 0 )
+        nthreads = online_cpus();
+
+    printf( "distribution,algorithm,threads,size,runs,wall_min,wall_median,"
+            "wall_p95,thread_cpu_median,process_cpu_median,verified\n" );
+
+    for ( int d = 0; d < DIST_COUNT; d++ ) {
+        generate_input( (distribution_t) d, size, input, 0x5EEDULL );
+        memcpy( expect, input, size * sizeof( int ) );
+        qsort( expect, size, sizeof( int ), compare_int );
+
+        for ( size_t v = 0; v < sizeof( bench_variants ) /
+                                sizeof( bench_variants[0] ); v++ ) {
+            const bench_variant_t *bv = &bench_variants[v];
+            size_t threads = bv->threaded ? nthreads : 1;
+            int verified = 1;
+
+            for ( size_t r = 0; r < runs; r++ ) {
+                double w0 = clock_seconds( CLOCK_MONOTONIC );
+                double t0 = clock_seconds( CLOCK_THREAD_CPUTIME_ID );
+                double p0 = clock_seconds( CLOCK_PROCESS_CPUTIME_ID );
+                int *out = bv->run( size, input, threads );
+                pcpu[r] = clock_seconds( CLOCK_PROCESS_CPUTIME_ID ) - p0;
+                tcpu[r] = clock_seconds( CLOCK_THREAD_CPUTIME_ID ) - t0;
+                wall[r] = clock_seconds( CLOCK_MONOTONIC ) - w0;
+
+                verified &= memcmp( out, expect, size * sizeof( int ) ) == 0;
+                free( out );
+            }
+
+            bench_report( distribution_names[d], bv->name, threads, size,
+                          runs, wall, tcpu, pcpu, verified );
+        }
+
+        for ( size_t v = 0; v < sizeof( typed_variants ) /
+                                sizeof( typed_variants[0] ); v++ )
+            bench_typed( &typed_variants[v], distribution_names[d], size,
+                         input, runs, wall, tcpu, pcpu );
     }
+
+    free( input );
+    free( expect );
+    free( wall );
+    free( tcpu );
+    free( pcpu );
 }
 
 /*
- * Non-threaded recursive quicksort
+ * Self test (built with -DSORT_SELFTEST; make check)
  */
 
-static int *recursive_quicksort( size_t size, const int *data );
+#ifdef SORT_SELFTEST
 
-/// Public entry point for non-threaded quicksort (resets thread counter)
-/// @param size number of elements
-/// @param data original array
-/// @return newly allocated sorted array (caller must free)
-int *quicksort( size_t size, const int *data )
+/// Input sizes of the sort checks: empty, single, network, leaf and
+/// multi-level sizes, and one above every threaded cutoff
+static const size_t selftest_sizes[] = { 0, 1, 2, 16, 17, 1000, 70000 };
+
+/// Threads used by the threaded variants, whatever the CPU count
+#define SELFTEST_THREADS 4
+
+static size_t selftest_checks;
+static size_t selftest_failures;
+
+/// Counts one check and reports it on stderr when it failed
+static void selftest_check( int ok, const char *what, const char *dist,
+                            size_t size )
 {
-    total_threads = 0;                     // not used here, but reset anyway
-    return recursive_quicksort( size, data );
+    selftest_checks++;
+    if ( !ok ) {
+        selftest_failures++;
+        fprintf( stderr, "FAIL: %s (%s, %zu values)\n", what, dist, size );
+    }
 }
 
-static int *recursive_quicksort( size_t size, const int *data )
+/// Every sorting network, and small_sort under every kernel, on all
+/// 2^n inputs of zeros and ones (enough for a network, by the 0-1
+/// principle)
+static void selftest_networks( void )
 {
-    if ( size <= 1 ) {
-        int *res = malloc( size * sizeof( int ) );
-        if ( size == 1 ) res[0] = data[0];
-        return res;
+    static void ( *const networks[] )( int * ) = {
+        NULL, NULL, sort_network_2, sort_network_3, sort_network_4,
+        sort_network_5, sort_network_6, sort_network_7, sort_network_8,
+        sort_network_9, sort_network_10, sort_network_11, sort_network_12,
+        sort_network_13, sort_network_14, sort_network_15, sort_network_16
+    };
+    static const partition_kernel_t kernels[] = {
+        KERNEL_DUTCH, KERNEL_BLOCK, KERNEL_SIMD
+    };
+    int data[SMALL_SORT_CUTOFF];
+
+    for ( size_t n = 2; n <= SMALL_SORT_CUTOFF; n++ ) {
+        int ok = 1;
+        for ( unsigned bits = 0; bits < 1u << n; bits++ ) {
+            for ( size_t i = 0; i < n; i++ )
+                data[i] = ( bits >> i ) & 1;
+            networks[n]( data );
+            for ( size_t i = 1; i < n; i++ )
+                ok &= data[i - 1] <= data[i];
+        }
+        selftest_check( ok, "sorting network", "0-1 inputs", n );
     }
 
-    int pivot = data[0];
-    size_t less_cnt, same_cnt, more_cnt;
-    int *less = NULL, *same = NULL, *more = NULL;
+    for ( size_t k = 0; k < sizeof( kernels ) / sizeof( kernels[0] ); k++ ) {
+        partition_kernel = kernels[k];
+        for ( size_t n = 0; n <= SMALL_SORT_CUTOFF; n++ ) {
+            int ok = 1;
+            for ( unsigned bits = 0; bits < 1u << n; bits++ ) {
+                for ( size_t i = 0; i < n; i++ )
+                    data[i] = ( bits >> i ) & 1;
+                small_sort( n, data );
+                for ( size_t i = 1; i < n; i++ )
+                    ok &= data[i - 1] <= data[i];
+            }
+            selftest_check( ok, "small_sort", "0-1 inputs", n );
+        }
+    }
+    partition_kernel = KERNEL_SIMD;
+}
 
-    partition_array( pivot, size, data,
-                     &less_cnt, &less, &same_cnt, &same, &more_cnt, &more );
+/// Every -a engine (including the threaded ones and the legacy sort)
+/// under every -K kernel, -P pivot and -R setting, against qsort
+static void selftest_sorts( const char *dist, size_t size, const int *input,
+                            const int *expect )
+{
+    static const partition_kernel_t kernels[] = {
+        KERNEL_DUTCH, KERNEL_BLOCK, KERNEL_SIMD
+    };
+    static const char *const kernel_names[] = { "dutch", "block", "simd" };
+    static const pivot_strategy_t pivots[] = {
+        PIVOT_FIRST, PIVOT_MEDIAN, PIVOT_RANDOM
+    };
+    static const char *const pivot_names[] = { "first", "median", "random" };
+    size_t bytes = size * sizeof( int );
+    char what[64];
 
-    int *sorted_less = recursive_quicksort( less_cnt, less );
-    int *sorted_more = recursive_quicksort( more_cnt, more );
+    for ( size_t k = 0; k < 3; k++ )
+        for ( size_t p = 0; p < 3; p++ )
+            for ( int runs = 0; runs <= 1; runs++ ) {
+                partition_kernel = kernels[k];
+                pivot_strategy = pivots[p];
+                adaptive_runs = runs;
 
-    int *result = merge_partitions( less_cnt, sorted_less,
-                                    same_cnt, same,
-                                    more_cnt, sorted_more );
+                for ( size_t v = 0; v < sizeof( bench_variants ) /
+                                        sizeof( bench_variants[0] ); v++ ) {
+                    const bench_variant_t *bv = &bench_variants[v];
+                    int *out = bv->run( size, input, bv->threaded
+                                                     ? SELFTEST_THREADS
+                                                     : 1 );
+                    snprintf( what, sizeof( what ), "%s -K %s -P %s%s",
+                              bv->name, kernel_names[k], pivot_names[p],
+                              runs ? "" : " -R" );
+                    selftest_check( memcmp( out, expect, bytes ) == 0,
+                                    what, dist, size );
+                    free( out );
+                }
+            }
 
-    free( less );  free( same );  free( more );
-    free( sorted_less );
-    free( sorted_more );
+    /* the legacy sort recurses once per level, so keep it shallow */
+    if ( size <= 1000 ) {
+        int *out = legacy_quicksort( size, input );
+        selftest_check( memcmp( out, expect, bytes ) == 0, "legacy",
+                        dist, size );
+        free( out );
+    }
 
-    return result;
+    partition_kernel = KERNEL_SIMD;
+    pivot_strategy = PIVOT_MEDIAN;
+    adaptive_runs = 1;
 }
 
-/*
- * Threaded quicksort
- */
-
-/// Thread start routine – performs quicksort on its partition
-/// @param arg pointer to thread_args_t
-/// @return pointer to sorted array (cast to void*)
-static void *threaded_quicksort( void *arg )
+/// argsort with every engine: a permutation that orders the input,
+/// stable for radix and merge sort
+static void selftest_argsort( const char *dist, size_t size,
+                              const int *input, const int *expect )
 {
-    thread_args_t *args = (thread_args_t *) arg;
-    size_t size = args->size;
-    const int *data = args->data;
-
-    if ( size <= 1 ) {
-        int *res = malloc( size * sizeof( int ) );
-        if ( size == 1 ) res[0] = data[0];
-        args->result = res;
-        return (void *) res;
+    static const sort_algorithm_t algorithms[] = {
+        ALGO_QUICK, ALGO_RADIX, ALGO_SAMPLE, ALGO_MERGE, ALGO_AUTO
+    };
+    unsigned char *seen = calloc( size > 0 ? size : 1, 1 );
+    if ( seen == NULL ) {
+        perror( "malloc failed in selftest_argsort" );
+        exit( EXIT_FAILURE );
     }
 
-    int pivot = data[0];
-    size_t less_cnt, same_cnt, more_cnt;
-    int *less = NULL, *same = NULL, *more = NULL;
-
-    partition_array( pivot, size, data,
-                     &less_cnt, &less, &same_cnt, &same, &more_cnt, &more );
+    for ( size_t a = 0; a < 5; a++ ) {
+        size_t *perm = argsort( size, input, algorithms[a],
+                                SELFTEST_THREADS );
+        int stable = algorithms[a] == ALGO_RADIX ||
+                     algorithms[a] == ALGO_MERGE;
+        int ok = 1;
 
-    int *sorted_less = NULL;
-    int *sorted_more = NULL;
-    pthread_t thread_less, thread_more;
-    int spawned_less = 0, spawned_more = 0;
+        memset( seen, 0, size );
+        for ( size_t i = 0; i < size && ok; i++ ) {
+            ok = perm[i] < size && !seen[ perm[i] ] &&
+                 input[ perm[i] ] == expect[i];
+            if ( ok )
+                seen[ perm[i] ] = 1;
+            if ( ok && stable && i > 0 && expect[i - 1] == expect[i] )
+                ok = perm[i - 1] < perm[i];
+        }
+        selftest_check( ok, "argsort", dist, size );
+        free( perm );
+    }
+    free( seen );
+}
 
-    thread_args_t child_less = { less_cnt, less, NULL, 0 };
-    thread_args_t child_more = { more_cnt, more, NULL, 0 };
+/// Distinct values and counts, on one thread and several
+static void selftest_distinct( const char *dist, size_t size,
+                               const int *input, const int *expect )
+{
+    for ( size_t threads = 1; threads <= SELFTEST_THREADS;
+          threads += SELFTEST_THREADS - 1 ) {
+        size_t n, *counts;
+        int *values = distinct_values( size, input, &counts, threads, &n );
+        size_t at = 0, i = 0;
+        int ok = 1;
 
-    if ( less_cnt > 0 ) {
-        if ( pthread_create( &thread_less, NULL, threaded_quicksort,
-                             &child_less ) == 0 ) {
-            increment_thread_counter();
-            spawned_less = 1;
-        } else {
-            sorted_less = recursive_quicksort( less_cnt, less );
+        for ( ; i < n && ok; i++ ) {
+            ok = at + counts[i] <= size && expect[at] == values[i] &&
+                 expect[at + counts[i] - 1] == values[i] &&
+                 ( at + counts[i] == size ||
+                   expect[at + counts[i]] != values[i] );
+            at += counts[i];
         }
-    } else {
-        sorted_less = malloc( 0 );
+        selftest_check( ok && at == size, "distinct", dist, size );
+        free( values );
+        free( counts );
     }
+}
 
-    if ( more_cnt > 0 ) {
-        if ( pthread_create( &thread_more, NULL, threaded_quicksort,
-                             &child_more ) == 0 ) {
-            increment_thread_counter();
-            spawned_more = 1;
-        } else {
-            sorted_more = recursive_quicksort( more_cnt, more );
-        }
-    } else {
-        sorted_more = malloc( 0 );
+/// Percentiles, quickselect and top-k against the sorted reference
+static void selftest_select( const char *dist, size_t size,
+                             const int *input, const int *expect )
+{
+    static const double pcts[] = { 0, 1, 25, 50, 90, 99.9, 100 };
+    const size_t npcts = sizeof( pcts ) / sizeof( pcts[0] );
+    int values[sizeof( pcts ) / sizeof( pcts[0] )];
+    int ok = 1;
+
+    if ( size == 0 )
+        return;
+
+    select_percentiles( size, input, pcts, npcts, values,
+                        SELFTEST_THREADS );
+    for ( size_t i = 0; i < npcts; i++ ) {
+        size_t rank = (size_t) ( pcts[i] / 100.0 * (double) ( size - 1 ) +
+                                 0.5 );
+        ok &= values[i] == expect[rank];
     }
+    selftest_check( ok, "percentiles", dist, size );
+
+    selftest_check( quickselect( size, input, size / 2 ) ==
+                    expect[size / 2], "quickselect", dist, size );
 
-    if ( spawned_less ) {
-        void *ret;
-        pthread_join( thread_less, &ret );
-        sorted_less = (int *) ret;
+    size_t ks[] = { 0, 1, 10, size / 2, size };
+    for ( size_t j = 0; j < sizeof( ks ) / sizeof( ks[0] ); j++ ) {
+        size_t k = ks[j] < size ? ks[j] : size;
+        int *top = top_k( size, input, k, SELFTEST_THREADS );
+        ok = 1;
+        for ( size_t i = 0; i < k; i++ )
+            ok &= top[i] == expect[size - 1 - i];
+        selftest_check( ok, "top-k", dist, size );
+        free( top );
     }
-    if ( spawned_more ) {
-        void *ret;
-        pthread_join( thread_more, &ret );
-        sorted_more = (int *) ret;
+}
+
+/// The threaded quicksort and selection on inputs large enough for the
+/// parallel partition, with both two-way kernels
+static void selftest_parallel_partition( void )
+{
+    static const distribution_t dists[] = { DIST_RANDOM, DIST_FEW_UNIQUE };
+    size_t size = PARALLEL_PARTITION_MIN + 1000;
+    int *input = malloc( size * sizeof( int ) );
+    int *expect = malloc( size * sizeof( int ) );
+    if ( input == NULL || expect == NULL ) {
+        perror( "malloc failed in selftest_parallel_partition" );
+        exit( EXIT_FAILURE );
     }
 
-    int *result = merge_partitions( less_cnt, sorted_less,
-                                    same_cnt, same,
-                                    more_cnt, sorted_more );
+    for ( size_t d = 0; d < 2; d++ ) {
+        const char *name = distribution_names[ dists[d] ];
+        generate_input( dists[d], size, input, 0x5EEDULL );
+        memcpy( expect, input, size * sizeof( int ) );
+        qsort( expect, size, sizeof( int ), compare_int );
 
-    free( less );  free( same );  free( more );
-    if ( sorted_less && less_cnt > 0 ) free( sorted_less );
-    if ( sorted_more && more_cnt > 0 ) free( sorted_more );
+        for ( int k = KERNEL_BLOCK; k <= KERNEL_SIMD; k++ ) {
+            partition_kernel = (partition_kernel_t) k;
+            int *out = threaded_quicksort( size, input, SELFTEST_THREADS,
+                                           NULL );
+            selftest_check( memcmp( out, expect, size * sizeof( int ) ) == 0,
+                            k == KERNEL_BLOCK ? "parallel partition -K block"
+                                              : "parallel partition -K simd",
+                            name, size );
+            free( out );
+            selftest_select( name, size, input, expect );
+        }
+    }
+    partition_kernel = KERNEL_SIMD;
+    free( input );
+    free( expect );
+}
 
-    args->result = result;
-    args->threads_spawned = spawned_less + spawned_more;
+/// Reads back a native int32 file and compares it with expect
+static int selftest_file_equals( const char *path, size_t size,
+                                 const int *expect )
+{
+    size_t n;
+    void *map = NULL;
+    size_t map_len = 0;
+    int *got = read_integers_binary( path, FORMAT_I32, &n, &map, &map_len );
+    int ok = n == size &&
+             memcmp( got, expect, size * sizeof( int ) ) == 0;
 
-    return (void *) result;
+    if ( map != NULL )
+        munmap( map, map_len );
+    else
+        free( got );
+    return ok;
 }
 
-/*
- * File I/O
- */
-
-/// Reads all integers from file, one per line
-/// @param filename name of input file
-/// @param out_size filled with number of integers read
-/// @return dynamically allocated array (caller must free)
-static int *read_integers_from_file( const char *filename, size_t *out_size )
+/// External sort (several runs), incremental updates with and without
+/// tiers, and the streaming sort, through files in a scratch directory
+static void selftest_files( const char *dir )
 {
-    FILE *fp = fopen( filename, "r" );
-    if ( fp == NULL ) {
-        perror( "fopen" );
+    size_t size = EXT_MIN_BUDGET / sizeof( int ) * 3 / 2;
+    int *input = malloc( size * sizeof( int ) );
+    int *expect = malloc( size * sizeof( int ) );
+    char in[PATH_MAX + 16], out[PATH_MAX + 16], base[PATH_MAX + 16];
+    if ( input == NULL || expect == NULL ) {
+        perror( "malloc failed in selftest_files" );
         exit( EXIT_FAILURE );
     }
+    snprintf( in, sizeof( in ), "%s/in.i32", dir );
+    snprintf( out, sizeof( out ), "%s/out.i32", dir );
+    snprintf( base, sizeof( base ), "%s/base.i32", dir );
 
-    size_t capacity = 256;
-    int *data = malloc( capacity * sizeof( int ) );
-    if ( data == NULL ) {
-        perror( "malloc" );
-        fclose( fp );
+    generate_input( DIST_RANDOM, size, input, 0x5EEDULL );
+    memcpy( expect, input, size * sizeof( int ) );
+    qsort( expect, size, sizeof( int ), compare_int );
+
+    /* external: the budget holds two thirds of the input */
+    ext_stats_t ext;
+    write_integers( in, FORMAT_I32, input, size );
+    external_sort( in, FORMAT_I32, out, FORMAT_I32, EXT_MIN_BUDGET,
+                   SELFTEST_THREADS, &ext );
+    selftest_check( ext.runs > 1 && selftest_file_equals( out, size, expect ),
+                    "external sort", "random", size );
+
+    /* update: four batches, merged each time and then every second */
+    for ( size_t tiers = 0; tiers <= 2; tiers += 2 ) {
+        size_t batch = size / 4;
+        update_stats_t upd;
+        for ( size_t b = 0; b < 4; b++ ) {
+            int *sorted = quicksort( batch, input + b * batch );
+            update_base( base, sorted, batch, tiers, &upd );
+            free( sorted );
+        }
+        int *all = quicksort( 4 * batch, input );
+        selftest_check( upd.deltas == 0 &&
+                        selftest_file_equals( base, 4 * batch, all ),
+                        tiers ? "tiered update" : "update", "random",
+                        4 * batch );
+        free( all );
+        unlink( base );
+    }
+
+    /* stream: the same values as text */
+    size_t streamed, chunks;
+    write_integers( out, FORMAT_TEXT, input, size );
+    int fd = open( out, O_RDONLY );
+    if ( fd < 0 ) {
+        perror( out );
         exit( EXIT_FAILURE );
     }
+    int *sorted = stream_sort( fd, FORMAT_TEXT, SELFTEST_THREADS,
+                               &streamed, &chunks );
+    close( fd );
+    selftest_check( streamed == size &&
+                    memcmp( sorted, expect, size * sizeof( int ) ) == 0,
+                    "stream sort", "random", size );
+    free( sorted );
 
-    size_t count = 0;
-    int value;
+    unlink( in );
+    unlink( out );
+    free( input );
+    free( expect );
+}
 
-    while ( fscanf( fp, "%d", &value ) == 1 ) {
-        if ( count >= capacity ) {
-            capacity *= 2;
-            data = realloc( data, capacity * sizeof( int ) );
-            if ( data == NULL ) {
-                perror( "realloc" );
-                fclose( fp );
-                exit( EXIT_FAILURE );
-            }
+/// Runs every check and prints a summary
+/// @return EXIT_SUCCESS if every check passed
+static int selftest( void )
+{
+    size_t max = 0;
+    for ( size_t s = 0; s < sizeof( selftest_sizes ) / sizeof( size_t ); s++ )
+        if ( selftest_sizes[s] > max )
+            max = selftest_sizes[s];
+    int *input = malloc( ( max > 0 ? max : 1 ) * sizeof( int ) );
+    int *expect = malloc( ( max > 0 ? max : 1 ) * sizeof( int ) );
+    if ( input == NULL || expect == NULL ) {
+        perror( "malloc failed in selftest" );
+        exit( EXIT_FAILURE );
+    }
+
+    selftest_networks();
+
+    for ( int d = 0; d < DIST_COUNT; d++ )
+        for ( size_t s = 0; s < sizeof( selftest_sizes ) / sizeof( size_t );
+              s++ ) {
+            size_t size = selftest_sizes[s];
+            generate_input( (distribution_t) d, size, input, 0x5EEDULL + s );
+            memcpy( expect, input, size * sizeof( int ) );
+            qsort( expect, size, sizeof( int ), compare_int );
+
+            selftest_sorts( distribution_names[d], size, input, expect );
+            selftest_argsort( distribution_names[d], size, input, expect );
+            selftest_distinct( distribution_names[d], size, input, expect );
+            selftest_select( distribution_names[d], size, input, expect );
         }
-        data[count++] = value;
+    free( input );
+    free( expect );
 
-        /* consume rest of line */
-        int ch;
-        while ( ( ch = fgetc( fp ) ) != '\n' && ch != EOF )
-            ;
+    selftest_parallel_partition();
+
+    const char *tmp = getenv( "TMPDIR" );
+    char dir[PATH_MAX];
+    snprintf( dir, sizeof( dir ), "%s/quicksort-test-XXXXXX",
+              tmp != NULL && *tmp != '\0' ? tmp : "/tmp" );
+    if ( mkdtemp( dir ) == NULL ) {
+        perror( dir );
+        exit( EXIT_FAILURE );
     }
+    selftest_files( dir );
+    rmdir( dir );
 
-    fclose( fp );
-    *out_size = count;
-    return data;
+    printf( "%zu checks, %zu failed\n", selftest_checks, selftest_failures );
+    return selftest_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+#endif
+
 /*
  * main
  */
 
+/// Prints the usage message
+static void usage( const char *prog )
+{
+    fprintf( stderr, "Usage: %s [-p] [-n] [-l] [-m] [-t threads] "
+             "[-a quick|radix|sample|merge|auto] [-P first|median|random] "
+             "[-K dutch|block|simd] [-f text|i32|i64] [-w out_file] "
+             "[-W text|i32|i64] [-M budget] [-q pct,...] [-k count] [-i] "
+             "[-R] [-U base_file [-L tiers]] [-S text|json] "
+             "[-u values|counts|total] file_of_integers\n"
+             "       %s -b size [-r runs] [-z skew] [-t threads] "
+             "[-P pivot] [-K kernel]\n",
+             prog, prog );
+}
+
 /// Program entry point
 /// @param argc argument count
-/// @param argv arguments: [-p] filename
+/// @param argv arguments: [-p] [-n] [-l] [-m] [-t threads] [-a algorithm]
+///             [-P pivot] [-K kernel] [-f format] [-w out_file]
+///             [-W format] [-M budget] [-q percentiles] [-k count] [-i]
+///             [-R] [-U base_file [-L tiers]] [-S format] [-u mode]
+///             filename, or -b size [-r runs] [-z skew] to benchmark;
+///             none in a -DSORT_SELFTEST build runs the self test
 /// @return EXIT_SUCCESS or EXIT_FAILURE
 int main( int argc, char *argv[] )
 {
+#ifdef SORT_SELFTEST
+    if ( argc == 1 )
+        return selftest();
+#endif
+
     int print_lists = 0;
+    int run_legacy = 0;
+    int count_misses = 0;
+    size_t num_threads = 0;     // 0 = one per online CPU
+    sort_algorithm_t algorithm = ALGO_QUICK;
+    int algorithm_set = 0;
+    int_format_t in_format = FORMAT_TEXT;
+    int_format_t out_format = FORMAT_TEXT;
+    int out_format_set = 0;
+    const char *out_file = NULL;
+    size_t bench_size = 0;
+    size_t bench_runs = 5;
+    size_t ext_budget = 0;      // 0 = sort in memory
+    double *percentiles = NULL;
+    size_t num_percentiles = 0;
+    size_t top_count = 0;
+    int want_top = 0;
+    int want_argsort = 0;
+    const char *base_file = NULL;
+    size_t tiers = 0;           // 0 = merge every batch into the base
+    int stats_format = -1;      // -1 = off, 0 = text, 1 = JSON
+    distinct_mode_t distinct_mode = DISTINCT_OFF;
 
     int opt;
-    while ( ( opt = getopt( argc, argv, "p" ) ) != -1 ) {
+    while ( ( opt = getopt( argc, argv,
+                            "pnlmt:a:P:K:f:w:W:b:r:z:M:q:k:iRU:L:S:u:" ) ) != -1 ) {
         switch ( opt ) {
             case 'p':
                 print_lists = 1;
                 break;
+            case 'n':
+                list_separator = "\n";
+                break;
+            case 'l':
+                run_legacy = 1;
+                break;
+            case 'm':
+                count_misses = 1;
+                break;
+            case 't':
+                if ( parse_count( optarg, &num_threads ) != 0 ) {
+                    fprintf( stderr, "Error: bad thread count '%s' "
+                             "(0 = one per CPU)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'a':
+                if ( strcmp( optarg, "quick" ) == 0 )
+                    algorithm = ALGO_QUICK;
+                else if ( strcmp( optarg, "radix" ) == 0 )
+                    algorithm = ALGO_RADIX;
+                else if ( strcmp( optarg, "sample" ) == 0 )
+                    algorithm = ALGO_SAMPLE;
+                else if ( strcmp( optarg, "merge" ) == 0 )
+                    algorithm = ALGO_MERGE;
+                else if ( strcmp( optarg, "auto" ) == 0 )
+                    algorithm = ALGO_AUTO;
+                else {
+                    fprintf( stderr, "Error: unknown algorithm '%s' "
+                             "(quick, radix, sample, merge, auto)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                algorithm_set = 1;
+                break;
+            case 'P':
+                if ( strcmp( optarg, "first" ) == 0 )
+                    pivot_strategy = PIVOT_FIRST;
+                else if ( strcmp( optarg, "median" ) == 0 )
+                    pivot_strategy = PIVOT_MEDIAN;
+                else if ( strcmp( optarg, "random" ) == 0 )
+                    pivot_strategy = PIVOT_RANDOM;
+                else {
+                    fprintf( stderr, "Error: unknown pivot strategy '%s' "
+                             "(first, median, random)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'K':
+                if ( strcmp( optarg, "dutch" ) == 0 )
+                    partition_kernel = KERNEL_DUTCH;
+                else if ( strcmp( optarg, "block" ) == 0 )
+                    partition_kernel = KERNEL_BLOCK;
+                else if ( strcmp( optarg, "simd" ) == 0 )
+                    partition_kernel = KERNEL_SIMD;
+                else {
+                    fprintf( stderr, "Error: unknown partition kernel '%s' "
+                             "(dutch, block, simd)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+            case 'W':
+                if ( parse_format( optarg, opt == 'f' ? &in_format
+                                                      : &out_format ) != 0 ) {
+                    fprintf( stderr, "Error: unknown format '%s' "
+                             "(text, i32, i64)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                if ( opt == 'W' )
+                    out_format_set = 1;
+                break;
+            case 'w':
+                out_file = optarg;
+                break;
+            case 'b':
+                if ( parse_count( optarg, &bench_size ) != 0 ||
+                     bench_size == 0 ) {
+                    fprintf( stderr, "Error: bad benchmark size '%s' "
+                             "(at least 1)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                if ( parse_count( optarg, &bench_runs ) != 0 ||
+                     bench_runs == 0 ) {
+                    fprintf( stderr, "Error: bad run count '%s' "
+                             "(at least 1)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'z': {
+                char *end;
+                zipf_skew = strtod( optarg, &end );
+                if ( end == optarg || *end != '\0' || !( zipf_skew > 0.0 ) ||
+                     zipf_skew > ZIPF_MAX_SKEW ) {
+                    fprintf( stderr, "Error: bad Zipf skew '%s' "
+                             "(0 < s <= %g)\n", optarg, ZIPF_MAX_SKEW );
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'M':
+                ext_budget = parse_budget( optarg );
+                if ( ext_budget < EXT_MIN_BUDGET ) {
+                    fprintf( stderr, "Error: bad memory budget '%s' "
+                             "(at least %dk)\n", optarg,
+                             EXT_MIN_BUDGET >> 10 );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                free( percentiles );
+                num_percentiles = parse_percentiles( optarg, &percentiles );
+                if ( num_percentiles == 0 ) {
+                    fprintf( stderr, "Error: bad percentile list '%s' "
+                             "(e.g. 50,90,99.9)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k':
+                if ( parse_count( optarg, &top_count ) != 0 ) {
+                    fprintf( stderr, "Error: bad count '%s'\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                want_top = 1;
+                break;
+            case 'i':
+                want_argsort = 1;
+                break;
+            case 'R':
+                adaptive_runs = 0;
+                break;
+            case 'U':
+                base_file = optarg;
+                break;
+            case 'L':
+                if ( parse_count( optarg, &tiers ) != 0 ) {
+                    fprintf( stderr, "Error: bad tier count '%s' "
+                             "(0 = merge every batch)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                if ( strcmp( optarg, "text" ) == 0 )
+                    stats_format = 0;
+                else if ( strcmp( optarg, "json" ) == 0 )
+                    stats_format = 1;
+                else {
+                    fprintf( stderr, "Error: unknown statistics format "
+                             "'%s' (text, json)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+#ifndef SORT_STATS
+                fprintf( stderr, "Error: -S needs a build with "
+                         "-DSORT_STATS\n" );
+                return EXIT_FAILURE;
+#endif
+                break;
+            case 'u':
+                if ( strcmp( optarg, "values" ) == 0 )
+                    distinct_mode = DISTINCT_VALUES;
+                else if ( strcmp( optarg, "counts" ) == 0 )
+                    distinct_mode = DISTINCT_COUNTS;
+                else if ( strcmp( optarg, "total" ) == 0 )
+                    distinct_mode = DISTINCT_TOTAL;
+                else {
+                    fprintf( stderr, "Error: unknown distinct mode '%s' "
+                             "(values, counts, total)\n", optarg );
+                    return EXIT_FAILURE;
+                }
+                break;
             default:
-                fprintf( stderr, "Usage: %s [-p] file_of_integers\n",
-                         argv[0] );
+                usage( argv[0] );
                 return EXIT_FAILURE;
         }
     }
 
+    pivot_seed = mix64( (unsigned long long) time( NULL ) ^
+                        (unsigned long long) getpid() );
+
+    if ( bench_size > 0 ) {
+        run_benchmark( bench_size, bench_runs, num_threads );
+        return EXIT_SUCCESS;
+    }
+
     if ( optind >= argc ) {
         fprintf( stderr, "Error: missing input file\n" );
         return EXIT_FAILURE;
@@ -328,17 +6364,311 @@ int main( int argc, char *argv[] )
     }
 
     char *filename = argv[optind];
+
+    /* the report modes are dispatched one at a time, so a second one
+     * would be silently ignored */
+    if ( ( num_percentiles > 0 || want_top ) +
+         ( distinct_mode != DISTINCT_OFF ) + want_argsort > 1 ) {
+        fprintf( stderr, "Error: -q/-k, -u and -i cannot be combined\n" );
+        return EXIT_FAILURE;
+    }
+
+    /* -w writes one result: the percentile values or the top values */
+    if ( out_file != NULL && num_percentiles > 0 && want_top ) {
+        fprintf( stderr, "Error: -w takes the result of -q or -k, "
+                 "not both\n" );
+        return EXIT_FAILURE;
+    }
+
+    /* -U stores the sorted input; the report-only modes never sort it */
+    if ( base_file != NULL ) {
+        const char *flag = num_percentiles > 0 ? "-q"
+                         : want_top ? "-k"
+                         : distinct_mode != DISTINCT_OFF ? "-u"
+                         : want_argsort ? "-i"
+                         : NULL;
+        if ( flag != NULL ) {
+            fprintf( stderr, "Error: %s cannot be used with -U\n", flag );
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* -M and - only sort: the other modes need the whole input, in
+     * its original order, before they start */
+    const char *mode_flag = num_percentiles > 0 ? "-q"
+                          : want_top ? "-k"
+                          : distinct_mode != DISTINCT_OFF ? "-u"
+                          : want_argsort ? "-i"
+                          : base_file != NULL ? "-U"
+                          : algorithm_set ? "-a"
+                          : run_legacy ? "-l"
+                          : count_misses ? "-m"
+                          : NULL;
+
+    if ( ext_budget > 0 ) {
+        if ( mode_flag != NULL ) {
+            fprintf( stderr, "Error: %s cannot be used with -M\n",
+                     mode_flag );
+            return EXIT_FAILURE;
+        }
+        if ( strcmp( filename, "-" ) == 0 ) {
+            fprintf( stderr, "Error: -M needs an input file, not - "
+                     "(standard input)\n" );
+            return EXIT_FAILURE;
+        }
+        if ( out_file == NULL ) {
+            fprintf( stderr, "Error: -M needs an output file (-w)\n" );
+            return EXIT_FAILURE;
+        }
+        if ( !out_format_set )
+            out_format = in_format;
+
+        ext_stats_t ext;
+        STAT_RESET();
+        double ext_start = clock_seconds( CLOCK_MONOTONIC );
+        external_sort( filename, in_format, out_file, out_format,
+                       ext_budget, num_threads, &ext );
+        double ext_end = clock_seconds( CLOCK_MONOTONIC );
+
+        printf( "External time:      %f\n", ext_end - ext_start );
+        printf( "Values:             %zu\n", ext.values );
+        printf( "Runs:               %zu\n", ext.runs );
+        printf( "Merge passes:       %zu\n", ext.passes );
+        if ( stats_format >= 0 )
+            stats_report( "external", stats_format );
+        return EXIT_SUCCESS;
+    }
+
+    /* standard input is sorted as it streams in */
+    if ( strcmp( filename, "-" ) == 0 ) {
+        if ( mode_flag != NULL ) {
+            fprintf( stderr, "Error: %s cannot be used with - (standard "
+                     "input)\n", mode_flag );
+            return EXIT_FAILURE;
+        }
+
+        size_t streamed, chunks;
+        STAT_RESET();
+        double stream_start = clock_seconds( CLOCK_MONOTONIC );
+        int *sorted = stream_sort( STDIN_FILENO, in_format, num_threads,
+                                   &streamed, &chunks );
+        double stream_end = clock_seconds( CLOCK_MONOTONIC );
+
+        if ( streamed == 0 ) {
+            fprintf( stderr, "Error: no integers found in input\n" );
+            free( sorted );
+            return EXIT_FAILURE;
+        }
+        printf( "Stream time:        %f\n", stream_end - stream_start );
+        printf( "Values:             %zu\n", streamed );
+        printf( "Chunks:             %zu\n", chunks );
+        if ( stats_format >= 0 )
+            stats_report( "stream", stats_format );
+        if ( print_lists ) {
+            printf( "Resulting list:  " );
+            print_array( sorted, streamed );
+            printf( "\n" );
+        }
+        if ( out_file != NULL )
+            write_integers( out_file, out_format_set ? out_format
+                                                     : in_format,
+                            sorted, streamed );
+        free( sorted );
+        return EXIT_SUCCESS;
+    }
+
     size_t num_elements;
-    int *original_data = read_integers_from_file( filename, &num_elements );
+    void *input_map = NULL;
+    size_t input_map_len = 0;
+    int *original_data;
+
+    if ( in_format == FORMAT_TEXT )
+        original_data = read_integers_from_file( filename, &num_elements );
+    else
+        original_data = read_integers_binary( filename, in_format,
+                                              &num_elements, &input_map,
+                                              &input_map_len );
+    if ( !out_format_set )
+        out_format = in_format;
 
     if ( num_elements == 0 ) {
         fprintf( stderr, "Error: no integers found in file\n" );
-        free( original_data );
+        if ( input_map == NULL )
+            free( original_data );
         return EXIT_FAILURE;
     }
 
-    clock_t start, end;
-    double cpu_time;
+    /* selection only: no full sort */
+    if ( num_percentiles > 0 || want_top ) {
+        STAT_RESET();
+        if ( num_percentiles > 0 ) {
+            int *values = malloc( num_percentiles * sizeof( int ) );
+            if ( values == NULL ) {
+                perror( "malloc" );
+                return EXIT_FAILURE;
+            }
+            double sel_start = clock_seconds( CLOCK_MONOTONIC );
+            select_percentiles( num_elements, original_data, percentiles,
+                                num_percentiles, values, num_threads );
+            double sel_end = clock_seconds( CLOCK_MONOTONIC );
+
+            printf( "Select time:        %f\n", sel_end - sel_start );
+            for ( size_t i = 0; i < num_percentiles; i++ )
+                printf( "p%-18g%d\n", percentiles[i], values[i] );
+            if ( out_file != NULL )
+                write_integers( out_file, out_format, values,
+                                num_percentiles );
+            free( values );
+            if ( stats_format >= 0 )
+                stats_report( "percentiles", stats_format );
+        }
+        if ( want_top ) {
+            double sel_start = clock_seconds( CLOCK_MONOTONIC );
+            int *top = top_k( num_elements, original_data, top_count,
+                              num_threads );
+            double sel_end = clock_seconds( CLOCK_MONOTONIC );
+            size_t got = top_count < num_elements ? top_count
+                                                  : num_elements;
+
+            printf( "Top-k time:         %f\n", sel_end - sel_start );
+            printf( "Top %zu:  ", got );
+            print_array( top, got );
+            printf( "\n" );
+            if ( out_file != NULL )
+                write_integers( out_file, out_format, top, got );
+            free( top );
+            if ( stats_format >= 0 )
+                stats_report( "top-k", stats_format );
+        }
+        free( percentiles );
+        if ( input_map != NULL )
+            munmap( input_map, input_map_len );
+        else
+            free( original_data );
+        return EXIT_SUCCESS;
+    }
+
+    /* distinct values only: duplicates are dropped while sorting */
+    if ( distinct_mode != DISTINCT_OFF ) {
+        size_t num_distinct;
+        size_t *counts = NULL;
+        STAT_RESET();
+        double dist_start = clock_seconds( CLOCK_MONOTONIC );
+        int *values = distinct_values( num_elements, original_data,
+                                       distinct_mode == DISTINCT_COUNTS
+                                           ? &counts : NULL,
+                                       num_threads, &num_distinct );
+        double dist_end = clock_seconds( CLOCK_MONOTONIC );
+
+        printf( "Distinct time:      %f\n", dist_end - dist_start );
+        printf( "Distinct values:    %zu\n", num_distinct );
+        if ( stats_format >= 0 )
+            stats_report( "distinct", stats_format );
+        if ( distinct_mode == DISTINCT_VALUES ) {
+            printf( "Unique values:  " );
+            print_array( values, num_distinct );
+            printf( "\n" );
+        } else if ( distinct_mode == DISTINCT_COUNTS ) {
+            for ( size_t i = 0; i < num_distinct; i++ )
+                printf( "%d %zu\n", values[i], counts[i] );
+        }
+        if ( out_file != NULL && distinct_mode != DISTINCT_TOTAL )
+            write_integers( out_file, out_format, values, num_distinct );
+
+        free( values );
+        free( counts );
+        if ( input_map != NULL )
+            munmap( input_map, input_map_len );
+        else
+            free( original_data );
+        return EXIT_SUCCESS;
+    }
+
+    /* permutation only: the indices are printed / written instead of
+     * the values */
+    if ( want_argsort ) {
+        if ( num_elements > INT_MAX ) {
+            fprintf( stderr, "Error: too many integers for int indices\n" );
+            return EXIT_FAILURE;
+        }
+        STAT_RESET();
+        double arg_start = clock_seconds( CLOCK_MONOTONIC );
+        size_t *perm = argsort( num_elements, original_data, algorithm,
+                                num_threads );
+        double arg_end = clock_seconds( CLOCK_MONOTONIC );
+
+        int ordered = 1;
+        int *indices = malloc( num_elements * sizeof( int ) );
+        if ( indices == NULL ) {
+            perror( "malloc" );
+            return EXIT_FAILURE;
+        }
+        for ( size_t i = 0; i < num_elements; i++ ) {
+            indices[i] = (int) perm[i];
+            if ( i > 0 && original_data[ perm[i - 1] ] >
+                          original_data[ perm[i] ] )
+                ordered = 0;
+        }
+
+        printf( "Argsort time:       %f\n", arg_end - arg_start );
+        printf( "Ordered:            %s\n", ordered ? "yes" : "NO" );
+        if ( stats_format >= 0 )
+            stats_report( "argsort", stats_format );
+        if ( print_lists ) {
+            printf( "Permutation:  " );
+            print_array( indices, num_elements );
+            printf( "\n" );
+        }
+        if ( out_file != NULL )
+            write_integers( out_file, out_format, indices, num_elements );
+
+        free( indices );
+        free( perm );
+        if ( input_map != NULL )
+            munmap( input_map, input_map_len );
+        else
+            free( original_data );
+        return EXIT_SUCCESS;
+    }
+
+    /* incremental update: sort only the new batch and merge it into
+     * the base file */
+    if ( base_file != NULL ) {
+        pool_stats_t stats;
+        update_stats_t upd;
+
+        STAT_RESET();
+        double upd_start = clock_seconds( CLOCK_MONOTONIC );
+        int *batch = threaded_quicksort( num_elements, original_data,
+                                         num_threads, &stats );
+        double upd_mid = clock_seconds( CLOCK_MONOTONIC );
+        update_base( base_file, batch, num_elements, tiers, &upd );
+        double upd_end = clock_seconds( CLOCK_MONOTONIC );
+
+        printf( "Batch sort time:    %f\n", upd_mid - upd_start );
+        printf( "Merge time:         %f\n", upd_end - upd_mid );
+        printf( "Base values:        %zu\n", upd.base );
+        printf( "Pending deltas:     %zu%s\n", upd.deltas,
+                upd.merged ? " (merged)" : "" );
+        if ( stats_format >= 0 )
+            stats_report( "update", stats_format );
+
+        free( batch );
+        if ( input_map != NULL )
+            munmap( input_map, input_map_len );
+        else
+            free( original_data );
+        return EXIT_SUCCESS;
+    }
+
+    if ( algorithm == ALGO_AUTO ) {
+        algorithm = choose_algorithm( num_elements, original_data );
+        printf( "Algorithm:          %s\n",
+                algorithm == ALGO_RADIX ? "radix" : "quick" );
+    }
+
+    double start, end;
+    double wall_time;
 
     /* Non-threaded version */
     if ( print_lists ) {
@@ -347,12 +6677,31 @@ int main( int argc, char *argv[] )
         printf( "\n" );
     }
 
-    start = clock();
-    int *sorted1 = quicksort( num_elements, original_data );
-    end = clock();
-    cpu_time = (double)( end - start ) / CLOCKS_PER_SEC;
+    STAT_RESET();
+    int miss_fd = count_misses ? branch_misses_start() : -1;
+    start = clock_seconds( CLOCK_MONOTONIC );
+    int *sorted1;
+    if ( algorithm == ALGO_RADIX )
+        sorted1 = radix_sort( num_elements, original_data, 1 );
+    else if ( algorithm == ALGO_SAMPLE )
+        sorted1 = samplesort( num_elements, original_data, 1, NULL );
+    else if ( algorithm == ALGO_MERGE )
+        sorted1 = merge_sort( num_elements, original_data, 1 );
+    else
+        sorted1 = quicksort( num_elements, original_data );
+    end = clock_seconds( CLOCK_MONOTONIC );
+    long long misses = branch_misses_stop( miss_fd );
+    wall_time = end - start;
 
-    printf( "Non-threaded time:  %f\n", cpu_time );
+    printf( "Non-threaded time:  %f\n", wall_time );
+    if ( count_misses ) {
+        if ( misses >= 0 )
+            printf( "Branch misses:      %lld\n", misses );
+        else
+            printf( "Branch misses:      unavailable\n" );
+    }
+    if ( stats_format >= 0 )
+        stats_report( "non-threaded", stats_format );
 
     if ( print_lists ) {
         printf( "Resulting list:  " );
@@ -361,6 +6710,17 @@ int main( int argc, char *argv[] )
     }
     free( sorted1 );
 
+    /* Original allocating version, for comparison */
+    if ( run_legacy ) {
+        start = clock_seconds( CLOCK_MONOTONIC );
+        int *sorted_legacy = legacy_quicksort( num_elements, original_data );
+        end = clock_seconds( CLOCK_MONOTONIC );
+        wall_time = end - start;
+
+        printf( "Legacy time:        %f\n", wall_time );
+        free( sorted_legacy );
+    }
+
     /* Threaded version */
     if ( print_lists ) {
         printf( "Unsorted list before threaded quicksort:  " );
@@ -368,37 +6728,48 @@ int main( int argc, char *argv[] )
         printf( "\n" );
     }
 
-    total_threads = 0;
+    pool_stats_t stats;
+    int *sorted2;
 
-    thread_args_t top_args = { num_elements, original_data, NULL, 0 };
-    pthread_t top_thread;
+    STAT_RESET();
+    start = clock_seconds( CLOCK_MONOTONIC );
+    if ( algorithm == ALGO_RADIX )
+        sorted2 = radix_sort( num_elements, original_data, num_threads );
+    else if ( algorithm == ALGO_SAMPLE )
+        sorted2 = samplesort( num_elements, original_data, num_threads,
+                              &stats );
+    else if ( algorithm == ALGO_MERGE )
+        sorted2 = merge_sort( num_elements, original_data, num_threads );
+    else
+        sorted2 = threaded_quicksort( num_elements, original_data,
+                                      num_threads, &stats );
+    end = clock_seconds( CLOCK_MONOTONIC );
 
-    start = clock();
-    if ( pthread_create( &top_thread, NULL, threaded_quicksort,
-                         &top_args ) != 0 ) {
-        perror( "pthread_create top level" );
-        free( original_data );
-        return EXIT_FAILURE;
-    }
-    increment_thread_counter();   // count the top-level thread
-
-    void *thread_ret;
-    pthread_join( top_thread, &thread_ret );
-    end = clock();
+    wall_time = end - start;
 
-    cpu_time = (double)( end - start ) / CLOCKS_PER_SEC;
-
-    printf( "Threaded time:      %f\n", cpu_time );
-    printf( "Threads spawned:    %d\n", total_threads );
+    printf( "Threaded time:      %f\n", wall_time );
+    if ( algorithm != ALGO_RADIX && algorithm != ALGO_MERGE ) {
+        printf( "Pool threads:       %zu\n", stats.workers );
+        printf( "Tasks executed:     %lu\n", stats.tasks );
+        printf( "Steals:             %lu\n", stats.steals );
+    }
+    if ( stats_format >= 0 )
+        stats_report( "threaded", stats_format );
 
     if ( print_lists ) {
         printf( "Resulting list:  " );
-        print_array( top_args.result, num_elements );
+        print_array( sorted2, num_elements );
         printf( "\n" );
     }
 
-    free( top_args.result );
-    free( original_data );
+    if ( out_file != NULL )
+        write_integers( out_file, out_format, sorted2, num_elements );
+
+    free( sorted2 );
+    if ( input_map != NULL )
+        munmap( input_map, input_map_len );
+    else
+        free( original_data );
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
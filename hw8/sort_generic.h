@@ -0,0 +1,162 @@
+/*
+ * sort_generic.h
+ *
+ * Type-generic introsort, instantiated at compile time by macro.
+ *
+ * SORT_GENERIC_DEFINE( name, type, less ) expands to
+ *
+ *     static void name( size_t size, type *data );
+ *
+ * which sorts data[0, size) in place.  less( a, b ) is a function-like
+ * macro (or inline function) that is nonzero when a sorts before b.
+ * It is expanded straight into the loops, so unlike qsort there is no
+ * call through a function pointer per comparison.
+ *
+ * It is a plain introsort.  It partitions three ways (Dutch national
+ * flag) around a median-of-three or ninther pivot, recurses on the
+ * smaller side, switches to heapsort after 2*log2(n) levels, and
+ * finishes short ranges with insertion sort.
+ *
+ * quicksort.c's int introsort (introsort_loop) is separate and does
+ * more: sorting-network leaves, block and SIMD partition kernels,
+ * pdqsort-style pattern breaking after unbalanced partitions, and
+ * run detection.  None of that is here; those parts are written for
+ * int keys, and the generic sort is kept short so its cost stays
+ * comparable with qsort's.
+ */
+
+#ifndef SORT_GENERIC_H
+#define SORT_GENERIC_H
+
+#include <stddef.h> /* size_t */
+
+/// Ranges at or below this size are finished with insertion sort
+#define SORT_GENERIC_CUTOFF 16
+
+/// Ascending order for integer types
+#define SORT_LESS( a, b ) ( (a) < (b) )
+
+/// Ascending order for floating types, with NaNs sorted last (a plain
+/// < is not a strict weak order once NaNs are present)
+#define SORT_LESS_FLOAT( a, b ) \
+    ( (a) < (b) || ( (b) != (b) && (a) == (a) ) )
+
+#define SORT_GENERIC_DEFINE( name, type, less )                             \
+                                                                            \
+static void name##_insertion( size_t size, type *data )                     \
+{                                                                           \
+    for ( size_t i = 1; i < size; i++ ) {                                   \
+        type v = data[i];                                                   \
+        size_t j = i;                                                       \
+        while ( j > 0 && less( v, data[j - 1] ) ) {                         \
+            data[j] = data[j - 1];                                          \
+            j--;                                                            \
+        }                                                                   \
+        data[j] = v;                                                        \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static void name##_sift_down( type *data, size_t root, size_t size )        \
+{                                                                           \
+    type v = data[root];                                                    \
+                                                                            \
+    for ( ;; ) {                                                            \
+        size_t child = 2 * root + 1;                                        \
+        if ( child >= size )                                                \
+            break;                                                          \
+        if ( child + 1 < size && less( data[child], data[child + 1] ) )     \
+            child++;                                                        \
+        if ( !less( v, data[child] ) )                                      \
+            break;                                                          \
+        data[root] = data[child];                                           \
+        root = child;                                                       \
+    }                                                                       \
+    data[root] = v;                                                         \
+}                                                                           \
+                                                                            \
+static void name##_heap_sort( size_t size, type *data )                     \
+{                                                                           \
+    for ( size_t i = size / 2; i-- > 0; )                                   \
+        name##_sift_down( data, i, size );                                  \
+    for ( size_t end = size; end-- > 1; ) {                                 \
+        type t = data[0];                                                   \
+        data[0] = data[end];                                                \
+        data[end] = t;                                                      \
+        name##_sift_down( data, 0, end );                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static type name##_median3( type a, type b, type c )                        \
+{                                                                           \
+    if ( less( b, a ) ) {                                                   \
+        type t = a;                                                         \
+        a = b;                                                              \
+        b = t;                                                              \
+    }                                                                       \
+    if ( less( c, b ) )                                                     \
+        b = less( c, a ) ? a : c;                                           \
+    return b;                                                               \
+}                                                                           \
+                                                                            \
+static type name##_pivot( size_t size, const type *data )                   \
+{                                                                           \
+    size_t mid = size / 2, last = size - 1;                                 \
+    if ( size <= 40 )                                                       \
+        return name##_median3( data[0], data[mid], data[last] );            \
+                                                                            \
+    size_t step = size / 8;                                                 \
+    return name##_median3(                                                  \
+        name##_median3( data[0], data[step], data[2 * step] ),              \
+        name##_median3( data[mid - step], data[mid], data[mid + step] ),    \
+        name##_median3( data[last - 2 * step], data[last - step],           \
+                        data[last] ) );                                     \
+}                                                                           \
+                                                                            \
+static void name##_loop( size_t size, type *data, unsigned depth_left )     \
+{                                                                           \
+    while ( size > SORT_GENERIC_CUTOFF ) {                                  \
+        if ( depth_left == 0 ) {                                            \
+            name##_heap_sort( size, data );                                 \
+            return;                                                         \
+        }                                                                   \
+        depth_left--;                                                       \
+                                                                            \
+        /* Dutch national flag: [0, lt) < pivot, [gt, size) > pivot */      \
+        type pivot = name##_pivot( size, data );                            \
+        size_t lt = 0, i = 0, gt = size;                                    \
+        while ( i < gt ) {                                                  \
+            type x = data[i];                                               \
+            if ( less( x, pivot ) ) {                                       \
+                data[i++] = data[lt];                                       \
+                data[lt++] = x;                                             \
+            } else if ( less( pivot, x ) ) {                                \
+                data[i] = data[--gt];                                       \
+                data[gt] = x;                                               \
+            } else {                                                        \
+                i++;                                                        \
+            }                                                               \
+        }                                                                   \
+                                                                            \
+        size_t more = size - gt;                                            \
+        if ( lt < more ) {                                                  \
+            name##_loop( lt, data, depth_left );                            \
+            data += gt;                                                     \
+            size = more;                                                    \
+        } else {                                                            \
+            name##_loop( more, data + gt, depth_left );                     \
+            size = lt;                                                      \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    name##_insertion( size, data );                                         \
+}                                                                           \
+                                                                            \
+static void name( size_t size, type *data )                                 \
+{                                                                           \
+    unsigned depth = 0;                                                     \
+    for ( size_t n = size; n > 1; n >>= 1 )                                 \
+        depth += 2;                                                         \
+    name##_loop( size, data, depth );                                       \
+}
+
+#endif /* SORT_GENERIC_H */